@@ -0,0 +1,192 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010-2012 Michael Stapelberg
+ *
+ * filters.c: runs the effect kernels of filter.c (as the loader dispatched
+ *            them, i.e. the AVX2 build where the CPU has it) and a scalar
+ *            reference, which works on one channel at a time, over the same
+ *            image. Prints the time of both and exits with an error if their
+ *            results differ.
+ *
+ * The kernels are static, so filter.c is included as it is.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#include "../filter.c"
+
+/* Defined in i3lock.c, which is not linked in. */
+bool debug_mode = false;
+
+/* The reference has to stay scalar, or this compares the vectorizer with
+ * itself. */
+#if defined(__GNUC__) && !defined(__clang__)
+#define SCALAR __attribute__((optimize("no-tree-vectorize")))
+#else
+#define SCALAR
+#endif
+
+SCALAR static void dim_reference(uint8_t *data, int width, int height, int stride, uint32_t mul) {
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = data + (size_t)y * stride;
+        for (int x = 0; x < width; x++)
+            for (int c = 0; c < 3; c++)
+                row[x * 4 + c] = (row[x * 4 + c] * mul) >> 8;
+    }
+}
+
+SCALAR static void desaturate_reference(uint8_t *data, int width, int height, int stride, uint32_t amount) {
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = data + (size_t)y * stride;
+        for (int x = 0; x < width; x++) {
+            const uint32_t p = ((uint32_t *)row)[x];
+            const uint32_t luma = (77 * ((p >> 16) & 0xff) + 150 * ((p >> 8) & 0xff) + 29 * (p & 0xff)) >> 8;
+            for (int shift = 0; shift < 24; shift += 8) {
+                const uint32_t v = (p >> shift) & 0xff;
+                ((uint32_t *)row)[x] &= ~(0xffu << shift);
+                ((uint32_t *)row)[x] |= ((v * (256 - amount) + luma * amount) >> 8) << shift;
+            }
+        }
+    }
+}
+
+SCALAR static void vignette_reference(uint8_t *data, int width, int height, int stride, int strength) {
+    const int64_t cx = width / 2 + 1, cy = height / 2 + 1;
+    const uint32_t s = (strength * 256) / 100;
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = data + (size_t)y * stride;
+        const uint32_t dy2 = ((int64_t)(y - cy) * (y - cy) * 32768) / (cy * cy);
+        for (int x = 0; x < width; x++) {
+            const uint32_t d2 = ((int64_t)(x - cx) * (x - cx) * 32768) / (cx * cx) + dy2;
+            const uint32_t mul = 256 - ((s * (d2 > 65536 ? 65536 : d2)) >> 16);
+            for (int c = 0; c < 3; c++)
+                row[x * 4 + c] = (row[x * 4 + c] * mul) >> 8;
+        }
+    }
+}
+
+SCALAR static void pixelate_reference(uint8_t *data, int width, int height, int stride, int size) {
+    for (int top = 0; top < height; top += size) {
+        const int bottom = (top + size < height ? top + size : height);
+        for (int left = 0; left < width; left += size) {
+            const int right = (left + size < width ? left + size : width);
+            const uint32_t pixels = (right - left) * (bottom - top);
+            for (int c = 0; c < 4; c++) {
+                uint32_t s = 0;
+                for (int y = top; y < bottom; y++)
+                    for (int x = left; x < right; x++)
+                        s += data[(size_t)y * stride + x * 4 + c];
+                for (int y = top; y < bottom; y++)
+                    for (int x = left; x < right; x++)
+                        data[(size_t)y * stride + x * 4 + c] = (s + pixels / 2) / pixels;
+            }
+        }
+    }
+}
+
+enum kernel {
+    KERNEL_DIM,
+    KERNEL_DESATURATE,
+    KERNEL_VIGNETTE,
+    KERNEL_PIXELATE,
+};
+
+static const char *kernel_names[] = { "dim:50", "desaturate:100", "vignette:50", "pixelate:10" };
+
+static void run_kernel(enum kernel kernel, bool reference, uint8_t *data, int width, int height, int stride) {
+    switch (kernel) {
+    case KERNEL_DIM:
+        if (reference)
+            dim_reference(data, width, height, stride, 128);
+        else
+            for (int y = 0; y < height; y++)
+                dim_row((uint32_t *)(data + (size_t)y * stride), width, 128);
+        break;
+    case KERNEL_DESATURATE:
+        if (reference)
+            desaturate_reference(data, width, height, stride, 256);
+        else
+            for (int y = 0; y < height; y++)
+                desaturate_row((uint32_t *)(data + (size_t)y * stride), width, 256);
+        break;
+    case KERNEL_VIGNETTE:
+        if (reference)
+            vignette_reference(data, width, height, stride, 50);
+        else
+            vignette(data, width, height, stride, 50);
+        break;
+    case KERNEL_PIXELATE:
+        if (reference)
+            pixelate_reference(data, width, height, stride, 10);
+        else
+            pixelate(data, width, height, stride, 10);
+        break;
+    }
+}
+
+/*
+ * Runs the kernel and its reference repeats times each on a copy of the
+ * image, returns whether both produced the same image.
+ *
+ */
+static bool compare(enum kernel kernel, const uint8_t *image, int width, int height, int stride, int repeats) {
+    const size_t size = (size_t)height * stride;
+    uint8_t *a = malloc(size), *b = malloc(size);
+    if (a == NULL || b == NULL)
+        err(EXIT_FAILURE, "malloc()");
+
+    uint64_t kernel_ns = UINT64_MAX, reference_ns = UINT64_MAX;
+    for (int r = 0; r < repeats; r++) {
+        memcpy(a, image, size);
+        memcpy(b, image, size);
+
+        uint64_t start = now_ns();
+        run_kernel(kernel, false, a, width, height, stride);
+        const uint64_t k = now_ns() - start;
+
+        start = now_ns();
+        run_kernel(kernel, true, b, width, height, stride);
+        const uint64_t s = now_ns() - start;
+
+        /* The fastest run, the others were disturbed by something. */
+        kernel_ns = (k < kernel_ns ? k : kernel_ns);
+        reference_ns = (s < reference_ns ? s : reference_ns);
+    }
+
+    const bool same = (memcmp(a, b, size) == 0);
+    printf("  %-16s %8.2f ms  scalar %8.2f ms  %5.1fx  %s\n",
+           kernel_names[kernel], kernel_ns / 1e6, reference_ns / 1e6,
+           (double)reference_ns / kernel_ns, same ? "ok" : "DIFFERENT");
+
+    free(a);
+    free(b);
+    return same;
+}
+
+int main(int argc, char *argv[]) {
+    /* How often each kernel runs, the fastest run is printed. */
+    int repeats = (argc > 1 ? atoi(argv[1]) : 5);
+    if (repeats < 1)
+        repeats = 1;
+
+    /* 4K, with a stride larger than the row (like a cairo surface might
+     * have) and a height which is not a multiple of the pixelate block. */
+    const int width = 3840, height = 2157, stride = width * 4 + 64;
+    uint8_t *image = malloc((size_t)height * stride);
+    if (image == NULL)
+        err(EXIT_FAILURE, "malloc()");
+    srand(0);
+    for (size_t i = 0; i < (size_t)height * stride; i++)
+        image[i] = rand();
+
+    printf("%dx%d, stride %d\n", width, height, stride);
+    bool ok = true;
+    for (int kernel = KERNEL_DIM; kernel <= KERNEL_PIXELATE; kernel++)
+        ok &= compare(kernel, image, width, height, stride, repeats);
+
+    free(image);
+    return (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
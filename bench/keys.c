@@ -0,0 +1,264 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010-2012 Michael Stapelberg
+ *
+ * keys.c: replays synthetic key traces through handle_key_press_core(), with
+ *         a renderer and PAM which do nothing, and prints how many events per
+ *         second the key path handles and how long each key took. The traces
+ *         cover typing passwords, an autotype burst, key repeat and typing on
+ *         a second layout.
+ *
+ * The traces are generated from text, there is deliberately no way to record
+ * real input: for a screen locker, that would be a password logger.
+ *
+ * The key handling lives in input.c, which i3lock links as well. The
+ * renderer and PAM are replaced by stubs.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <err.h>
+#include <ev.h>
+#include <xcb/xcb.h>
+#include <cairo.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "../input.h"
+#include "../unlock_indicator.h"
+#include "../secure.h"
+#include "../stats.h"
+
+bool debug_mode = false;
+struct ev_loop *main_loop;
+
+static struct xkb_context *xkb_context;
+static struct xkb_keymap *xkb_keymap;
+static struct xkb_state *xkb_state;
+
+/*******************************************************************************
+ * The renderer (unlock_indicator.c) and PAM, which do nothing here.
+ ******************************************************************************/
+
+unlock_state_t unlock_state;
+pam_state_t pam_state;
+static uint64_t redraws = 0;
+static int pam_calls = 0;
+
+void redraw_screen(void) {
+    redraws++;
+}
+
+void start_clear_indicator_timeout(void) {
+}
+
+void stop_clear_indicator_timeout(void) {
+}
+
+/*
+ * Called on Return. Every password is wrong, so this does what i3lock does
+ * once PAM rejected it, without the authentication thread.
+ *
+ */
+static void input_done(void) {
+    pam_calls++;
+    pam_state = STATE_PAM_WRONG;
+    clear_input();
+}
+
+/*******************************************************************************
+ * Traces.
+ ******************************************************************************/
+
+typedef struct event {
+    xkb_keycode_t key;
+    bool press;
+} event_t;
+
+static event_t *trace;
+static int trace_length;
+static int trace_size;
+
+static void add_event(xkb_keycode_t key, bool press) {
+    if (trace_length == trace_size) {
+        trace_size = (trace_size == 0 ? 1024 : trace_size * 2);
+        if ((trace = realloc(trace, trace_size * sizeof(event_t))) == NULL)
+            err(EXIT_FAILURE, "realloc()");
+    }
+    trace[trace_length++] = (event_t){ key, press };
+}
+
+/*
+ * Finds a key which produces the given keysym (if utf8 is NULL) or the given
+ * UTF-8 character on the given layout, on level 0 or 1 (Shift). Exits if there
+ * is none.
+ *
+ */
+static xkb_keycode_t find_key(xkb_layout_index_t layout, xkb_keysym_t keysym, const char *utf8,
+                              size_t length, bool *shift) {
+    for (xkb_keycode_t key = xkb_keymap_min_keycode(xkb_keymap); key <= xkb_keymap_max_keycode(xkb_keymap); key++) {
+        for (xkb_level_index_t level = 0; level < 2; level++) {
+            const xkb_keysym_t *syms;
+            if (xkb_keymap_key_get_syms_by_level(xkb_keymap, key, layout, level, &syms) != 1)
+                continue;
+
+            char buffer[8];
+            if (utf8 == NULL ? syms[0] != keysym
+                             : (xkb_keysym_to_utf8(syms[0], buffer, sizeof(buffer)) != (int)length + 1 ||
+                                memcmp(buffer, utf8, length) != 0))
+                continue;
+
+            *shift = (level == 1);
+            return key;
+        }
+    }
+
+    errx(EXIT_FAILURE, "No key for \"%.*s\" (keysym 0x%x) on layout %u", (int)length, utf8 ? utf8 : "", keysym, layout);
+}
+
+static xkb_keycode_t key_for(xkb_layout_index_t layout, xkb_keysym_t keysym) {
+    bool shift;
+    return find_key(layout, keysym, NULL, 0, &shift);
+}
+
+static void press_key(xkb_layout_index_t layout, xkb_keysym_t keysym) {
+    xkb_keycode_t key = key_for(layout, keysym);
+    add_event(key, true);
+    add_event(key, false);
+}
+
+/*
+ * Adds the key presses and releases which type the given text on the given
+ * layout, including Shift where necessary.
+ *
+ */
+static void type_text(xkb_layout_index_t layout, const char *text) {
+    const xkb_keycode_t shift_key = key_for(layout, XKB_KEY_Shift_L);
+
+    while (*text != '\0') {
+        size_t length = 1;
+        while (!isutf(text[length]))
+            length++;
+
+        bool shift;
+        xkb_keycode_t key = find_key(layout, XKB_KEY_NoSymbol, text, length, &shift);
+        if (shift)
+            add_event(shift_key, true);
+        add_event(key, true);
+        add_event(key, false);
+        if (shift)
+            add_event(shift_key, false);
+
+        text += length;
+    }
+}
+
+/*
+ * Presses the given key count times without releasing it, like the X server
+ * does for key repeat, and releases it once.
+ *
+ */
+static void repeat_key(xkb_layout_index_t layout, xkb_keysym_t keysym, int count) {
+    xkb_keycode_t key = key_for(layout, keysym);
+    for (int i = 0; i < count; i++)
+        add_event(key, true);
+    add_event(key, false);
+}
+
+/*******************************************************************************
+ * Replaying.
+ ******************************************************************************/
+
+/*
+ * Feeds the trace through the key handler the given number of times and
+ * prints the statistics.
+ *
+ */
+static void replay(const char *name, xkb_layout_index_t layout, int repeats) {
+    xkb_state_update_mask(xkb_state, 0, 0, 0, 0, 0, layout);
+    histogram_reset(&key_handler_time);
+    histogram_reset(&key_handler_render_time);
+    redraws = 0;
+    pam_calls = 0;
+
+    const uint64_t start = now_ns();
+    for (int r = 0; r < repeats; r++) {
+        for (int i = 0; i < trace_length; i++) {
+            const xkb_keycode_t key = trace[i].key;
+            if (!trace[i].press) {
+                xkb_state_update_key(xkb_state, key, XKB_KEY_UP);
+                continue;
+            }
+
+            handle_key_press_core(xkb_state, key, xkb_state_key_get_one_sym(xkb_state, key));
+        }
+    }
+    const uint64_t elapsed = now_ns() - start;
+
+    printf("%s: %d events, %.0f events/s, %llu redraws, %d authentications\n",
+           name, trace_length * repeats, trace_length * repeats / (elapsed / 1e9),
+           (unsigned long long)redraws, pam_calls);
+    histogram_print_row("ns/key", &key_handler_time);
+    histogram_print_row("ns/key with redraw", &key_handler_render_time);
+
+    trace_length = 0;
+    clear_input();
+}
+
+int main(int argc, char *argv[]) {
+    /* How often each trace is replayed, for more stable numbers. */
+    int repeats = (argc > 1 ? atoi(argv[1]) : 100);
+    if (repeats < 1)
+        repeats = 1;
+
+    static char fallback[PASSWORD_SIZE];
+    if (!secure_arena_init(PASSWORD_SIZE) || (password = secure_alloc(PASSWORD_SIZE)) == NULL)
+        password = fallback;
+
+    input_init(input_done, NULL);
+
+    main_loop = EV_DEFAULT;
+
+    struct xkb_rule_names names = { .layout = "us,de" };
+    if ((xkb_context = xkb_context_new(0)) == NULL ||
+        (xkb_keymap = xkb_keymap_new_from_names(xkb_context, &names, 0)) == NULL ||
+        (xkb_state = xkb_state_new(xkb_keymap)) == NULL)
+        errx(EXIT_FAILURE, "Could not compile the us,de keymap, is xkeyboard-config installed?");
+
+    /* A password of average length, typed and sent ten times. */
+    for (int i = 0; i < 10; i++) {
+        type_text(0, "Correct horse 4 battery staple!");
+        press_key(0, XKB_KEY_Return);
+    }
+    replay("passwords", 0, repeats);
+
+    /* A password manager typing a long password at once, cleared with
+     * Ctrl-U. */
+    for (int i = 0; i < 8; i++)
+        type_text(0, "x7Q#pL2vR9m@Wk4T$zN8bY3&cF6hJ1sD");
+    add_event(key_for(0, XKB_KEY_Control_L), true);
+    press_key(0, XKB_KEY_u);
+    add_event(key_for(0, XKB_KEY_Control_L), false);
+    replay("autotype burst", 0, repeats);
+
+    /* A key held down, then backspace held down until the password is
+     * empty (and beyond). */
+    repeat_key(0, XKB_KEY_x, 300);
+    repeat_key(0, XKB_KEY_BackSpace, 320);
+    replay("key repeat", 0, repeats);
+
+    /* Multi-byte characters on the second layout, partly deleted again,
+     * which goes through u8_dec(). */
+    for (int i = 0; i < 10; i++) {
+        type_text(1, "Grüße aus Köln");
+        for (int j = 0; j < 4; j++)
+            press_key(1, XKB_KEY_BackSpace);
+        press_key(1, XKB_KEY_Escape);
+    }
+    replay("second layout (de)", 1, repeats);
+
+    return EXIT_SUCCESS;
+}
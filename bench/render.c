@@ -0,0 +1,167 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010-2012 Michael Stapelberg
+ *
+ * render.c: renders frames with draw_image_core() onto cairo image surfaces,
+ *           without an X server, and prints what each frame costs. A script
+ *           of unlock/PAM state changes (typing, backspace, verifying, wrong
+ *           password) is played for every combination of screen layout and
+ *           background.
+ *
+ * This is the path of the backends which render the whole window on every
+ * frame (Wayland). On X11, the indicator is composited on the X server, see
+ * the frame statistics printed with --debug.
+ *
+ * The file is included as it is, so that the statistics of each scenario can
+ * be reset and the spinner can be advanced without an event loop.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../unlock_indicator.c"
+
+/* Defined in i3lock.c and xinerama.c, which are not linked in. */
+xcb_window_t win;
+uint32_t last_resolution[2];
+bool debug_mode = false;
+bool unlock_indicator = true;
+char *image_path = NULL;
+cairo_surface_t *img = NULL;
+bool low_memory = false;
+bool tile = false;
+int xr_screens = 0;
+Rect *xr_resolutions = NULL;
+
+static const struct {
+    unlock_state_t unlock_state;
+    pam_state_t pam_state;
+    int frames;
+} script[] = {
+    { STATE_KEY_PRESSED, STATE_PAM_IDLE, 1 },           /* the first key */
+    { STATE_KEY_ACTIVE, STATE_PAM_IDLE, 12 },           /* typing */
+    { STATE_BACKSPACE_ACTIVE, STATE_PAM_IDLE, 2 },      /* a typo */
+    { STATE_KEY_ACTIVE, STATE_PAM_IDLE, 4 },
+    { STATE_KEY_PRESSED, STATE_PAM_VERIFY, SPINNER_FPS }, /* one second of PAM */
+    { STATE_KEY_PRESSED, STATE_PAM_WRONG, 1 },
+    { STATE_STARTED, STATE_PAM_IDLE, 1 },               /* hidden again */
+};
+
+#define SCRIPT_STEPS (sizeof(script) / sizeof(script[0]))
+
+static Rect one_screen[] = {
+    { 0, 0, 1920, 1080 },
+};
+
+static Rect three_screens[] = {
+    { 0, 0, 1920, 1080 },
+    { 1920, 0, 1920, 1080 },
+    { 3840, 0, 1920, 1080 },
+};
+
+static const struct {
+    const char *name;
+    uint32_t width;
+    uint32_t height;
+    int screens;
+    Rect *resolutions;
+} layouts[] = {
+    { "1080p", 1920, 1080, 1, one_screen },
+    { "4K (no Xinerama)", 3840, 2160, 0, NULL },
+    { "3x1080p", 5760, 1080, 3, three_screens },
+};
+
+enum background {
+    BACKGROUND_COLOR,
+    BACKGROUND_IMAGE,
+    BACKGROUND_TILE,
+};
+
+static const char *background_names[] = { "color", "image", "tiled image (-t)" };
+
+/*
+ * Creates an image to use as background, a diagonal gradient, so that it is
+ * not a solid color which pixman could special-case.
+ *
+ */
+static cairo_surface_t *create_image(int width, int height) {
+    cairo_surface_t *image = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+    cairo_t *ctx = cairo_create(image);
+    cairo_pattern_t *gradient = cairo_pattern_create_linear(0, 0, width, height);
+    cairo_pattern_add_color_stop_rgb(gradient, 0, 0.1, 0.3, 0.6);
+    cairo_pattern_add_color_stop_rgb(gradient, 1, 0.9, 0.6, 0.2);
+    cairo_set_source(ctx, gradient);
+    cairo_paint(ctx);
+    cairo_pattern_destroy(gradient);
+    cairo_destroy(ctx);
+    return image;
+}
+
+/*
+ * Plays the script the given number of times on the given layout and prints
+ * the statistics of all frames.
+ *
+ */
+static void run(int layout, enum background background, int repeats) {
+    last_resolution[0] = layouts[layout].width;
+    last_resolution[1] = layouts[layout].height;
+    xr_screens = layouts[layout].screens;
+    xr_resolutions = layouts[layout].resolutions;
+
+    tile = (background == BACKGROUND_TILE);
+    if (background == BACKGROUND_IMAGE)
+        img = create_image(last_resolution[0], last_resolution[1]);
+    else if (background == BACKGROUND_TILE)
+        img = create_image(256, 256);
+
+    cairo_surface_t *output = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                                         last_resolution[0], last_resolution[1]);
+    cairo_t *ctx = cairo_create(output);
+
+    histogram_reset(&render_time);
+    histogram_reset(&render_bytes);
+    histogram_reset(&render_surfaces);
+
+    for (int r = 0; r < repeats; r++) {
+        for (size_t step = 0; step < SCRIPT_STEPS; step++) {
+            unlock_state = script[step].unlock_state;
+            pam_state = script[step].pam_state;
+            spinner_angle = 0;
+            for (int frame = 0; frame < script[step].frames; frame++) {
+                draw_image_core(ctx, last_resolution);
+                spinner_angle = fmod(spinner_angle + (2 * M_PI / SPINNER_FPS), 2 * M_PI);
+            }
+        }
+    }
+
+    printf("%s, %ux%u, background: %s, %llu frames\n",
+           layouts[layout].name, last_resolution[0], last_resolution[1],
+           background_names[background], (unsigned long long)render_time.count);
+    histogram_print_row("ns/frame", &render_time);
+    histogram_print_row("bytes touched/frame", &render_bytes);
+    histogram_print_row("surfaces allocated/frame", &render_surfaces);
+
+    cairo_destroy(ctx);
+    cairo_surface_destroy(output);
+    if (img != NULL) {
+        cairo_surface_destroy(img);
+        img = NULL;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    /* How often the script is played, for more stable numbers. */
+    int repeats = (argc > 1 ? atoi(argv[1]) : 10);
+    if (repeats < 1)
+        repeats = 1;
+
+    theme_init();
+    srand(0);
+
+    for (size_t layout = 0; layout < sizeof(layouts) / sizeof(layouts[0]); layout++)
+        for (int background = BACKGROUND_COLOR; background <= BACKGROUND_TILE; background++)
+            run(layout, background, repeats);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,441 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010-2012 Michael Stapelberg
+ *
+ * blur.c: blurs a cairo image surface (used for the screenshot background).
+ *         Three successive box blurs approximate a gaussian blur. Each box
+ *         blur is separable into a horizontal and a vertical pass. For large
+ *         radii, the image is blurred at a reduced size and scaled back up,
+ *         which looks the same but is a lot cheaper. All steps are split
+ *         across all CPUs, and the inner loops run over contiguous memory
+ *         so that compilers can vectorize them.
+ *
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <cairo.h>
+
+#include "blur.h"
+#include "filter.h"
+
+#define BLUR_PASSES 3
+#define MAX_THREADS 16
+
+/* Radius of the box blurs when blurring a scaled down image. */
+#define SCALED_RADIUS 3
+
+struct blur_job {
+    const uint8_t *src;
+    int src_width;
+    int src_height;
+    /* size_t, so that row offsets are computed without overflowing int. */
+    size_t src_stride;
+
+    uint8_t *dst;
+    int dst_width;
+    int dst_height;
+    size_t dst_stride;
+
+    int radius;
+    int factor;
+
+    /* The rows of dst this job computes. */
+    int first_row, last_row;
+    /* The bytes of each row this job blurs vertically. */
+    int first_byte, last_byte;
+};
+
+static inline int clamp(int value, int max) {
+    return (value < 0 ? 0 : (value > max ? max : value));
+}
+
+/*
+ * Blurs the given rows of src horizontally and stores the result in dst. The
+ * sum over the box is kept for every channel and updated while sliding the box
+ * along the row. Only the edges of each row need clamping.
+ *
+ */
+VECTORIZED static void *blur_rows(void *arg) {
+    const struct blur_job *job = arg;
+    const int r = job->radius;
+    const int width = job->src_width;
+    const uint32_t mul = (65536 + r) / (2 * r + 1);
+    /* The pixels for which the box is completely inside the row. */
+    const int middle_start = (r < width ? r : width);
+    const int middle_end = (width - r - 1 > middle_start ? width - r - 1 : middle_start);
+
+    for (int y = job->first_row; y < job->last_row; y++) {
+        const uint8_t *restrict in = job->src + (size_t)y * job->src_stride;
+        uint8_t *restrict out = job->dst + (size_t)y * job->dst_stride;
+        uint32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+        for (int x = -r; x <= r; x++) {
+            const uint8_t *p = in + clamp(x, width - 1) * 4;
+            s0 += p[0];
+            s1 += p[1];
+            s2 += p[2];
+            s3 += p[3];
+        }
+
+#define BLUR_STEP(x, add, sub) do { \
+        out[(x) * 4 + 0] = (s0 * mul + 32768) >> 16; \
+        out[(x) * 4 + 1] = (s1 * mul + 32768) >> 16; \
+        out[(x) * 4 + 2] = (s2 * mul + 32768) >> 16; \
+        out[(x) * 4 + 3] = (s3 * mul + 32768) >> 16; \
+        s0 += (add)[0] - (sub)[0]; \
+        s1 += (add)[1] - (sub)[1]; \
+        s2 += (add)[2] - (sub)[2]; \
+        s3 += (add)[3] - (sub)[3]; \
+} while (0)
+
+        int x = 0;
+        for (; x < middle_start; x++)
+            BLUR_STEP(x, in + clamp(x + r + 1, width - 1) * 4, in);
+        for (; x < middle_end; x++)
+            BLUR_STEP(x, in + (x + r + 1) * 4, in + (x - r) * 4);
+        for (; x < width; x++)
+            BLUR_STEP(x, in + (width - 1) * 4, in + clamp(x - r, width - 1) * 4);
+
+#undef BLUR_STEP
+    }
+
+    return NULL;
+}
+
+/*
+ * Blurs the given columns (bytes) of src vertically and stores the result in
+ * dst. The sums for all columns are kept in one array, so the inner loops run
+ * over contiguous memory.
+ *
+ */
+VECTORIZED static void *blur_columns(void *arg) {
+    const struct blur_job *job = arg;
+    const int r = job->radius;
+    const int last = job->src_height - 1;
+    const int count = job->last_byte - job->first_byte;
+    const uint32_t mul = (65536 + r) / (2 * r + 1);
+    const uint8_t *src = job->src + job->first_byte;
+    uint8_t *dst = job->dst + job->first_byte;
+
+    /* When there is no memory, the image just stays less blurry. */
+    uint32_t *restrict sum = calloc(count, sizeof(uint32_t));
+    if (sum == NULL)
+        return NULL;
+
+    for (int y = -r; y <= r; y++) {
+        const uint8_t *restrict in = src + (size_t)clamp(y, last) * job->src_stride;
+        for (int b = 0; b < count; b++)
+            sum[b] += in[b];
+    }
+
+    for (int y = 0; y < job->src_height; y++) {
+        uint8_t *restrict out = dst + (size_t)y * job->dst_stride;
+        const uint8_t *restrict add = src + (size_t)clamp(y + r + 1, last) * job->src_stride;
+        const uint8_t *restrict sub = src + (size_t)clamp(y - r, last) * job->src_stride;
+        for (int b = 0; b < count; b++)
+            out[b] = (sum[b] * mul + 32768) >> 16;
+        for (int b = 0; b < count; b++)
+            sum[b] += add[b] - sub[b];
+    }
+
+    free(sum);
+    return NULL;
+}
+
+/*
+ * Scales the given rows of dst down from src by averaging blocks of
+ * factor x factor pixels. The rows of each block are summed up first, which
+ * runs over contiguous memory, then the columns of each block.
+ *
+ */
+VECTORIZED static void *scale_down_rows(void *arg) {
+    const struct blur_job *job = arg;
+    const int f = job->factor;
+    const int count = job->src_width * 4;
+
+    uint32_t *restrict sum = malloc(count * sizeof(uint32_t));
+    if (sum == NULL)
+        return NULL;
+
+    for (int y = job->first_row; y < job->last_row; y++) {
+        const int first = y * f;
+        const int last = (first + f < job->src_height ? first + f : job->src_height);
+        for (int b = 0; b < count; b++)
+            sum[b] = 0;
+
+        for (int sy = first; sy < last; sy++) {
+            const uint8_t *restrict in = job->src + (size_t)sy * job->src_stride;
+            for (int b = 0; b < count; b++)
+                sum[b] += in[b];
+        }
+
+        uint8_t *restrict out = job->dst + (size_t)y * job->dst_stride;
+        for (int x = 0; x < job->dst_width; x++) {
+            const int end = (x * f + f < job->src_width ? x * f + f : job->src_width);
+            const uint32_t pixels = (end - x * f) * (last - first);
+            uint32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+            for (int sx = x * f; sx < end; sx++) {
+                s0 += sum[sx * 4 + 0];
+                s1 += sum[sx * 4 + 1];
+                s2 += sum[sx * 4 + 2];
+                s3 += sum[sx * 4 + 3];
+            }
+            out[x * 4 + 0] = (s0 + pixels / 2) / pixels;
+            out[x * 4 + 1] = (s1 + pixels / 2) / pixels;
+            out[x * 4 + 2] = (s2 + pixels / 2) / pixels;
+            out[x * 4 + 3] = (s3 + pixels / 2) / pixels;
+        }
+    }
+
+    free(sum);
+    return NULL;
+}
+
+/*
+ * Returns the position of the center of destination pixel i in source pixels
+ * (in 1/256 pixels) when scaling up by the given factor, that is
+ * (i + 0.5) / factor - 0.5.
+ *
+ */
+static int scaled_position(int i, int factor) {
+    int pos = (512 * i + 256 - 256 * factor) / (2 * factor);
+    return (pos < 0 ? 0 : pos);
+}
+
+/*
+ * Scales the given rows of dst up from src using bilinear interpolation. Each
+ * row of src is interpolated horizontally once (the two most recently used
+ * ones are kept), then each row of dst is interpolated between two of those,
+ * which runs over contiguous memory. Weights are in 1/256.
+ *
+ */
+VECTORIZED static void *scale_up_rows(void *arg) {
+    const struct blur_job *job = arg;
+    const int f = job->factor;
+    const int count = job->dst_width * 4;
+
+    uint8_t *rows[2] = { malloc(count), malloc(count) };
+    int cached[2] = { -1, -1 };
+    int *left = malloc(job->dst_width * sizeof(int));
+    int *right = malloc(job->dst_width * sizeof(int));
+    uint16_t *weight = malloc(job->dst_width * sizeof(uint16_t));
+    if (rows[0] == NULL || rows[1] == NULL || left == NULL || right == NULL || weight == NULL)
+        goto out;
+
+    for (int x = 0; x < job->dst_width; x++) {
+        int pos = scaled_position(x, f);
+        left[x] = (pos >> 8 < job->src_width - 1 ? pos >> 8 : job->src_width - 1);
+        right[x] = (left[x] < job->src_width - 1 ? left[x] + 1 : left[x]);
+        weight[x] = pos & 255;
+    }
+
+    for (int y = job->first_row; y < job->last_row; y++) {
+        int pos = scaled_position(y, f);
+        const int top = (pos >> 8 < job->src_height - 1 ? pos >> 8 : job->src_height - 1);
+        const int bottom = (top < job->src_height - 1 ? top + 1 : top);
+        const uint16_t wy = pos & 255;
+
+        /* Find top and bottom (which are the same row at the bottom edge)
+         * among the cached rows, or interpolate them horizontally into the
+         * cached row which is not needed for this row of dst. */
+        const int wanted[2] = { top, bottom };
+        int slot[2];
+        for (int i = 0; i < 2; i++) {
+            if (cached[0] == wanted[i] || cached[1] == wanted[i]) {
+                slot[i] = (cached[0] == wanted[i] ? 0 : 1);
+                continue;
+            }
+            if (i == 0)
+                slot[i] = (cached[0] == bottom ? 1 : 0);
+            else slot[i] = 1 - slot[0];
+
+            const uint8_t *restrict in = job->src + (size_t)wanted[i] * job->src_stride;
+            uint8_t *restrict row = rows[slot[i]];
+            for (int x = 0; x < job->dst_width; x++) {
+                const uint8_t *l = in + left[x] * 4;
+                const uint8_t *r = in + right[x] * 4;
+                const uint16_t wx = weight[x];
+                for (int c = 0; c < 4; c++)
+                    row[x * 4 + c] = (l[c] * (256 - wx) + r[c] * wx + 128) >> 8;
+            }
+            cached[slot[i]] = wanted[i];
+        }
+
+        const uint8_t *a = rows[slot[0]];
+        const uint8_t *b = rows[slot[1]];
+        uint8_t *restrict out = job->dst + (size_t)y * job->dst_stride;
+        for (int c = 0; c < count; c++)
+            out[c] = (a[c] * (256 - wy) + b[c] * wy + 128) >> 8;
+    }
+
+out:
+    free(rows[0]);
+    free(rows[1]);
+    free(left);
+    free(right);
+    free(weight);
+    return NULL;
+}
+
+/*
+ * Runs the given function for all jobs in parallel and waits for them. If a
+ * thread cannot be created, the job runs in the calling thread instead.
+ *
+ */
+static void run_jobs(void *(*fn)(void *), struct blur_job *jobs, int count) {
+    pthread_t ids[MAX_THREADS];
+    bool started[MAX_THREADS];
+
+    for (int i = 1; i < count; i++)
+        started[i] = (pthread_create(&ids[i], NULL, fn, &jobs[i]) == 0);
+
+    fn(&jobs[0]);
+
+    for (int i = 1; i < count; i++) {
+        if (started[i])
+            pthread_join(ids[i], NULL);
+        else fn(&jobs[i]);
+    }
+}
+
+/*
+ * Prepares one job per thread which computes a part of the rows of dst (and
+ * a part of the columns, for the vertical blur pass).
+ *
+ */
+static int split_jobs(struct blur_job *jobs, struct blur_job *job, int threads) {
+    if (threads > job->dst_height)
+        threads = job->dst_height;
+
+    for (int i = 0; i < threads; i++) {
+        jobs[i] = *job;
+        jobs[i].first_row = (job->dst_height * i) / threads;
+        jobs[i].last_row = (job->dst_height * (i + 1)) / threads;
+        /* Keep the column ranges aligned to 16 pixels (one cache line), so
+         * that threads do not write to the same cache lines. */
+        jobs[i].first_byte = (((job->dst_width * i) / threads) & ~15) * 4;
+        jobs[i].last_byte = (i == threads - 1 ? job->dst_width : (((job->dst_width * (i + 1)) / threads) & ~15)) * 4;
+    }
+
+    return threads;
+}
+
+/*
+ * Blurs the given image (4 bytes per pixel) in place, using tmp (of the same
+ * size) as scratch space.
+ *
+ */
+static void blur_data(uint8_t *data, uint8_t *tmp, int width, int height, int stride, int radius, int passes, int threads) {
+    struct blur_job rows[MAX_THREADS], columns[MAX_THREADS];
+    struct blur_job job = {
+        .src = data, .src_width = width, .src_height = height, .src_stride = stride,
+        .dst = tmp, .dst_width = width, .dst_height = height, .dst_stride = stride,
+        .radius = radius,
+    };
+
+    int count = split_jobs(rows, &job, threads);
+    job.src = tmp;
+    job.dst = data;
+    split_jobs(columns, &job, threads);
+
+    for (int pass = 0; pass < passes; pass++) {
+        run_jobs(blur_rows, rows, count);
+        run_jobs(blur_columns, columns, count);
+    }
+}
+
+static int blur_threads(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cpus < 1 ? 1 : (cpus > MAX_THREADS ? MAX_THREADS : cpus));
+}
+
+/*
+ * Blurs the given image surface (ARGB32 or RGB24) in place. The radius is
+ * the one of each box blur, the resulting blur is about as strong as a
+ * gaussian blur with a standard deviation of radius.
+ *
+ */
+void blur_image_surface(cairo_surface_t *surface, int radius) {
+    cairo_format_t format = cairo_image_surface_get_format(surface);
+    if (radius <= 0 || (format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24))
+        return;
+
+    cairo_surface_flush(surface);
+
+    int width = cairo_image_surface_get_width(surface);
+    int height = cairo_image_surface_get_height(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    uint8_t *data = cairo_image_surface_get_data(surface);
+    if (data == NULL || width == 0 || height == 0)
+        return;
+
+    const int threads = blur_threads();
+
+    /* With a small radius, scaling would be visible, so blur at full size. */
+    int factor = radius / SCALED_RADIUS;
+    if (factor < 2) {
+        uint8_t *tmp = malloc((size_t)stride * height);
+        if (tmp != NULL)
+            blur_data(data, tmp, width, height, stride, radius, BLUR_PASSES, threads);
+        free(tmp);
+        cairo_surface_mark_dirty(surface);
+        return;
+    }
+
+    int small_width = (width + factor - 1) / factor;
+    int small_height = (height + factor - 1) / factor;
+    int small_stride = small_width * 4;
+    uint8_t *small = malloc((size_t)small_stride * small_height);
+    uint8_t *tmp = malloc((size_t)small_stride * small_height);
+    if (small == NULL || tmp == NULL)
+        goto out;
+
+    struct blur_job jobs[MAX_THREADS];
+    struct blur_job job = {
+        .src = data, .src_width = width, .src_height = height, .src_stride = stride,
+        .dst = small, .dst_width = small_width, .dst_height = small_height, .dst_stride = small_stride,
+        .factor = factor,
+    };
+    run_jobs(scale_down_rows, jobs, split_jobs(jobs, &job, threads));
+
+    blur_data(small, tmp, small_width, small_height, small_stride, radius / factor, BLUR_PASSES, threads);
+
+    job = (struct blur_job){
+        .src = small, .src_width = small_width, .src_height = small_height, .src_stride = small_stride,
+        .dst = data, .dst_width = width, .dst_height = height, .dst_stride = stride,
+        .factor = factor,
+    };
+    run_jobs(scale_up_rows, jobs, split_jobs(jobs, &job, threads));
+
+out:
+    free(small);
+    free(tmp);
+    cairo_surface_mark_dirty(surface);
+}
+
+/*
+ * Applies a single box blur with the given radius to the image surface
+ * (ARGB32 or RGB24) in place.
+ *
+ */
+void box_blur_image_surface(cairo_surface_t *surface, int radius) {
+    cairo_format_t format = cairo_image_surface_get_format(surface);
+    if (radius <= 0 || (format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24))
+        return;
+
+    cairo_surface_flush(surface);
+
+    int height = cairo_image_surface_get_height(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    uint8_t *data = cairo_image_surface_get_data(surface);
+    uint8_t *tmp = malloc((size_t)stride * height);
+    if (data != NULL && tmp != NULL && height > 0)
+        blur_data(data, tmp, cairo_image_surface_get_width(surface), height, stride, radius, 1, blur_threads());
+
+    free(tmp);
+    cairo_surface_mark_dirty(surface);
+}
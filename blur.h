@@ -0,0 +1,9 @@
+#ifndef _BLUR_H
+#define _BLUR_H
+
+#include <cairo.h>
+
+void blur_image_surface(cairo_surface_t *surface, int radius);
+void box_blur_image_surface(cairo_surface_t *surface, int radius);
+
+#endif
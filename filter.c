@@ -0,0 +1,279 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010-2012 Michael Stapelberg
+ *
+ * filter.c: effects which are applied to the background image once, after
+ *           loading it (or taking the screenshot): pixelate, dim, desaturate,
+ *           vignette and blur. The image is processed row by row (or in bands
+ *           of rows), so that the data stays in the cache while it is worked
+ *           on.
+ *
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cairo.h>
+
+#include "i3lock.h"
+#include "filter.h"
+#include "blur.h"
+#include "stats.h"
+
+#define MAX_EFFECTS 16
+
+extern bool debug_mode;
+
+enum effect_type {
+    EFFECT_PIXELATE,
+    EFFECT_DIM,
+    EFFECT_DESATURATE,
+    EFFECT_VIGNETTE,
+    EFFECT_BLUR,
+    EFFECT_BOX_BLUR,
+};
+
+static const struct {
+    const char *name;
+    enum effect_type type;
+    int default_value;
+    int max_value;
+} effect_types[] = {
+    { "pixelate", EFFECT_PIXELATE, 10, 500 },
+    { "dim", EFFECT_DIM, 50, 100 },
+    { "desaturate", EFFECT_DESATURATE, 100, 100 },
+    { "vignette", EFFECT_VIGNETTE, 50, 100 },
+    { "blur", EFFECT_BLUR, 10, 100 },
+    { "boxblur", EFFECT_BOX_BLUR, 10, 100 },
+};
+
+#define EFFECT_TYPES (sizeof(effect_types) / sizeof(effect_types[0]))
+
+/* The effects given on the command line, in order. */
+static struct {
+    int type;
+    int value;
+} effects[MAX_EFFECTS];
+static int effects_count = 0;
+
+/*
+ * Adds an effect given as "name" or "name:value". Returns false if the effect
+ * is unknown, the value is out of range or there are too many effects.
+ *
+ */
+bool add_effect(const char *spec) {
+    const char *colon = strchr(spec, ':');
+    size_t len = (colon ? (size_t)(colon - spec) : strlen(spec));
+
+    if (effects_count == MAX_EFFECTS)
+        return false;
+
+    for (size_t i = 0; i < EFFECT_TYPES; i++) {
+        if (strlen(effect_types[i].name) != len || strncmp(effect_types[i].name, spec, len) != 0)
+            continue;
+
+        long value = effect_types[i].default_value;
+        if (colon != NULL) {
+            char *end;
+            value = strtol(colon + 1, &end, 10);
+            if (colon[1] == '\0' || *end != '\0' || value < 1 || value > effect_types[i].max_value)
+                return false;
+        }
+
+        effects[effects_count].type = i;
+        effects[effects_count].value = value;
+        effects_count++;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Scales red, green and blue of each pixel by mul / 256. Since the pixels
+ * are premultiplied, alpha stays as it is. Red and blue are scaled together.
+ *
+ */
+VECTORIZED static void dim_row(uint32_t *restrict row, int width, uint32_t mul) {
+    for (int x = 0; x < width; x++) {
+        const uint32_t p = row[x];
+        const uint32_t rb = (((p & 0xff00ff) * mul) >> 8) & 0xff00ff;
+        const uint32_t g = (((p & 0x00ff00) * mul) >> 8) & 0x00ff00;
+        row[x] = (p & 0xff000000) | rb | g;
+    }
+}
+
+/*
+ * Like dim_row(), but with a different factor for every pixel.
+ *
+ */
+VECTORIZED static void scale_row(uint32_t *restrict row, int width, const uint16_t *restrict mul) {
+    for (int x = 0; x < width; x++) {
+        const uint32_t p = row[x];
+        const uint32_t rb = (((p & 0xff00ff) * mul[x]) >> 8) & 0xff00ff;
+        const uint32_t g = (((p & 0x00ff00) * mul[x]) >> 8) & 0x00ff00;
+        row[x] = (p & 0xff000000) | rb | g;
+    }
+}
+
+/*
+ * Moves each pixel towards its luma by amount / 256. The luma of a
+ * premultiplied pixel is premultiplied as well, so this works on the data as
+ * it is.
+ *
+ */
+VECTORIZED static void desaturate_row(uint32_t *restrict row, int width, uint32_t amount) {
+    for (int x = 0; x < width; x++) {
+        const uint32_t p = row[x];
+        const uint32_t r = (p >> 16) & 0xff;
+        const uint32_t g = (p >> 8) & 0xff;
+        const uint32_t b = p & 0xff;
+        const uint32_t luma = (77 * r + 150 * g + 29 * b) >> 8;
+        const uint32_t keep = 256 - amount;
+        row[x] = (p & 0xff000000) |
+                 (((r * keep + luma * amount) >> 8) << 16) |
+                 (((g * keep + luma * amount) >> 8) << 8) |
+                 ((b * keep + luma * amount) >> 8);
+    }
+}
+
+VECTORIZED static void add_row(uint32_t *restrict sum, const uint8_t *restrict row, int count) {
+    for (int b = 0; b < count; b++)
+        sum[b] += row[b];
+}
+
+/*
+ * Replaces each block of size x size pixels by its average. The image is
+ * processed in bands of size rows: the rows of a band are summed up, then the
+ * averages of the blocks are written into all rows of the band.
+ *
+ */
+static void pixelate(uint8_t *data, int width, int height, int stride, int size) {
+    uint32_t *sum = malloc(width * 4 * sizeof(uint32_t));
+    uint8_t *band = malloc(width * 4);
+    if (sum == NULL || band == NULL)
+        goto out;
+
+    for (int top = 0; top < height; top += size) {
+        const int bottom = (top + size < height ? top + size : height);
+
+        memset(sum, 0, width * 4 * sizeof(uint32_t));
+        for (int y = top; y < bottom; y++)
+            add_row(sum, data + (size_t)y * stride, width * 4);
+
+        for (int left = 0; left < width; left += size) {
+            const int right = (left + size < width ? left + size : width);
+            const uint32_t pixels = (right - left) * (bottom - top);
+            for (int c = 0; c < 4; c++) {
+                uint32_t s = 0;
+                for (int x = left; x < right; x++)
+                    s += sum[x * 4 + c];
+                const uint8_t average = (s + pixels / 2) / pixels;
+                for (int x = left; x < right; x++)
+                    band[x * 4 + c] = average;
+            }
+        }
+
+        for (int y = top; y < bottom; y++)
+            memcpy(data + (size_t)y * stride, band, width * 4);
+    }
+
+out:
+    free(sum);
+    free(band);
+}
+
+/*
+ * Darkens the image towards the corners, the corners are darkened by
+ * strength percent.
+ *
+ */
+static void vignette(uint8_t *data, int width, int height, int stride, int strength) {
+    uint32_t *dx2 = malloc(width * sizeof(uint32_t));
+    uint16_t *mul = malloc(width * sizeof(uint16_t));
+    if (dx2 == NULL || mul == NULL)
+        goto out;
+
+    /* The squared distance from the center, relative to the distance of the
+     * corners, in 1/65536. */
+    const int64_t cx = width / 2 + 1, cy = height / 2 + 1;
+    for (int x = 0; x < width; x++)
+        dx2[x] = ((int64_t)(x - cx) * (x - cx) * 32768) / (cx * cx);
+
+    const uint32_t s = (strength * 256) / 100;
+    for (int y = 0; y < height; y++) {
+        const uint32_t dy2 = ((int64_t)(y - cy) * (y - cy) * 32768) / (cy * cy);
+        for (int x = 0; x < width; x++) {
+            const uint32_t d2 = dx2[x] + dy2;
+            mul[x] = 256 - ((s * (d2 > 65536 ? 65536 : d2)) >> 16);
+        }
+        scale_row((uint32_t *)(data + (size_t)y * stride), width, mul);
+    }
+
+out:
+    free(dx2);
+    free(mul);
+}
+
+/*
+ * Applies all effects given on the command line to the image surface (ARGB32
+ * or RGB24), in the order in which they were given.
+ *
+ */
+void apply_effects(cairo_surface_t *surface) {
+    if (effects_count == 0 || surface == NULL)
+        return;
+
+    cairo_format_t format = cairo_image_surface_get_format(surface);
+    if (format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24) {
+        fprintf(stderr, "Cannot apply effects to the image, unsupported format %d\n", format);
+        return;
+    }
+
+    cairo_surface_flush(surface);
+
+    const int width = cairo_image_surface_get_width(surface);
+    const int height = cairo_image_surface_get_height(surface);
+    const int stride = cairo_image_surface_get_stride(surface);
+    uint8_t *data = cairo_image_surface_get_data(surface);
+    if (data == NULL)
+        return;
+
+    for (int i = 0; i < effects_count; i++) {
+        const int value = effects[i].value;
+        const uint64_t start = now_ns();
+
+        switch (effect_types[effects[i].type].type) {
+        case EFFECT_PIXELATE:
+            pixelate(data, width, height, stride, value);
+            break;
+        case EFFECT_DIM:
+            for (int y = 0; y < height; y++)
+                dim_row((uint32_t *)(data + (size_t)y * stride), width, ((100 - value) * 256) / 100);
+            break;
+        case EFFECT_DESATURATE:
+            for (int y = 0; y < height; y++)
+                desaturate_row((uint32_t *)(data + (size_t)y * stride), width, (value * 256) / 100);
+            break;
+        case EFFECT_VIGNETTE:
+            vignette(data, width, height, stride, value);
+            break;
+        case EFFECT_BLUR:
+            cairo_surface_mark_dirty(surface);
+            blur_image_surface(surface, value);
+            break;
+        case EFFECT_BOX_BLUR:
+            cairo_surface_mark_dirty(surface);
+            box_blur_image_surface(surface, value);
+            break;
+        }
+
+        DEBUG("applied effect %s:%d to %dx%d image in %.1f ms\n",
+              effect_types[effects[i].type].name, value, width, height,
+              (now_ns() - start) / 1e6);
+    }
+
+    cairo_surface_mark_dirty(surface);
+}
@@ -0,0 +1,24 @@
+#ifndef _FILTER_H
+#define _FILTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <cairo.h>
+
+/* The kernels marked VECTORIZED are compiled twice on x86-64, once for AVX2
+ * and once for the baseline (SSE2). The dynamic loader picks the version
+ * matching the CPU at startup. Other architectures use their baseline, which
+ * includes NEON on aarch64. */
+#if defined(__x86_64__) && defined(__GLIBC__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define VECTORIZED __attribute__((target_clones("avx2", "default")))
+#endif
+#endif
+#ifndef VECTORIZED
+#define VECTORIZED
+#endif
+
+bool add_effect(const char *spec);
+void apply_effects(cairo_surface_t *surface);
+
+#endif
@@ -21,7 +21,14 @@
 #include <getopt.h>
 #include <string.h>
 #include <ev.h>
-#include <sys/mman.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
 #include <X11/XKBlib.h>
 #include <X11/extensions/XKBfile.h>
 #include <xkbcommon/xkbcommon.h>
@@ -35,6 +42,16 @@
 #include "unlock_indicator.h"
 #include "xinerama.h"
 #include "wayland.h"
+#include "stats.h"
+#include "blur.h"
+#include "filter.h"
+#include "theme.h"
+#include "secure.h"
+#include "rawimage.h"
+#include "input.h"
+#ifdef WITH_LOGIND
+#include "logind.h"
+#endif
 
 #ifdef BACKEND_WAYLAND
 struct display *wayland_display;
@@ -43,40 +60,95 @@ struct window *window;
 
 /* We need this for libxkbfile */
 static Display *display;
-char color[7] = "ffffff";
+/* The background color given with -c (in hex), overrides the theme. */
+static char color[7] = "";
+/* The theme file given with --theme, if any. */
+static char *theme_path = NULL;
+/* The PAM service (i.e. the file in /etc/pam.d) to authenticate with. */
+static char *pam_service = "i3lock";
 uint32_t last_resolution[2];
 xcb_window_t win;
 static xcb_cursor_t cursor;
 static pam_handle_t *pam_handle;
-int input_position = 0;
-/* Holds the password you enter (in UTF-8). */
-static char password[512];
 static bool beep = false;
 bool debug_mode = false;
 static bool dpms = false;
+/* With -d, the screen is turned off this many seconds after the last key
+ * press or release (while the password is empty). */
+static double dpms_timeout = 10.0;
+static struct ev_timer dpms_timer;
+static ev_tstamp last_input;
+static bool dpms_enabled = false;
+/* Whether we turned the screen off and there was no input since (which makes
+ * the X server turn it back on). */
+static bool screen_off = false;
+/* The number of DPMS requests sent (printed in debug mode). */
+static int dpms_requests = 0;
 bool unlock_indicator = true;
 static bool dont_fork = false;
+/* With --daemon, i3lock stays running and locks the screen whenever it is
+ * asked to (SIGUSR1 or the control socket). */
+static bool daemon_mode = false;
+static bool locked = false;
+static char *socket_path = NULL;
+/* The file descriptor given with --ready-fd, -1 if none. */
+static int ready_fd = -1;
 struct ev_loop *main_loop;
-static struct ev_timer *clear_pam_wrong_timeout;
+/* The timers are embedded (instead of allocated per use) and only armed while
+ * something is pending, so an idle lock screen has no timers at all. */
+static struct ev_timer clear_pam_wrong_timeout;
+static pthread_t auth_thread;
+static bool auth_thread_running = false;
+static int auth_result;
+static struct ev_async auth_done;
 extern unlock_state_t unlock_state;
 extern pam_state_t pam_state;
 
 static struct xkb_state *xkb_state;
 static struct xkb_context *xkb_context;
 static struct xkb_keymap *xkb_keymap;
+/* Set when a MappingNotify was received, see handle_mapping_notify(). */
+static bool keymap_reload_pending = false;
 
+char *image_path = NULL;
+/* The file descriptor given with --image-fd, -1 if none. */
+static int image_fd = -1;
 cairo_surface_t *img = NULL;
 bool tile = false;
-
-/* isutf, u8_dec © 2005 Jeff Bezanson, public domain */
-#define isutf(c) (((c) & 0xC0) != 0x80)
+bool low_memory = false;
+/* Radius of the blur applied to the screenshot used as background (-B), 0 to
+ * not take a screenshot at all. */
+static int blur_radius = 0;
+/* Whether img is a screenshot taken by take_screenshot(). */
+static bool img_is_screenshot = false;
+
+/* Keystroke latency statistics, printed in debug mode (see print_stats). */
+static histogram_t key_queue_time = { .name = "key event queued (ms, X server timestamp to handler)" };
+/* How PAM (e.g. a slow LDAP server) affects the user: how long verifying
+ * takes, and whether the lock screen stays responsive in the meantime. */
+static histogram_t auth_time = { .name = "Return to PAM result (ms)" };
+static histogram_t unlock_time = { .name = "Return to unlocked (ms)" };
+static histogram_t auth_frames = { .name = "frames drawn while verifying" };
+static histogram_t auth_keys = { .name = "keys pressed while verifying" };
+/* When i3lock was started, to report how long it took until the screen was
+ * locked. */
+static uint64_t start_time;
+/* When verifying the current password started, and the frames drawn since
+ * then (the keys pressed are counted in auth_keys_pressed). */
+static uint64_t auth_start;
+static uint64_t auth_start_frames;
 
 /*
- * Decrements i to point to the previous unicode glyph
+ * Returns the 64 bit FNV-1a hash of the given string.
  *
  */
-void u8_dec(char *s, int *i) {
-    (void)(isutf(s[--(*i)]) || isutf(s[--(*i)]) || isutf(s[--(*i)]) || --(*i));
+static uint64_t hash_string(const char *str) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *str != '\0'; str++) {
+        hash ^= (uint8_t)*str;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
 }
 
 /*
@@ -87,9 +159,15 @@ void u8_dec(char *s, int *i) {
  * Ideally, xkbcommon would ship something like this itself, but as of now
  * (version 0.2.0), it doesn’t.
  *
+ * The keymap is written into memory and only compiled if it differs from the
+ * one we compiled last time, since compiling is the expensive part.
+ *
  */
 static bool load_keymap(void) {
+    static uint64_t last_hash;
     bool ret = false;
+    char *text = NULL;
+    size_t size = 0;
     XkbFileInfo result;
     memset(&result, '\0', sizeof(result));
     result.xkb = XkbGetKeyboard(display, XkbAllMapComponentsMask, XkbUseCoreKbd);
@@ -98,19 +176,27 @@ static bool load_keymap(void) {
         return false;
     }
 
-    FILE *temp = tmpfile();
+    FILE *temp = open_memstream(&text, &size);
     if (temp == NULL) {
-        fprintf(stderr, "[i3lock] could not create tempfile\n");
+        fprintf(stderr, "[i3lock] could not create memory stream\n");
+        XkbFreeKeyboard(result.xkb, XkbAllComponentsMask, true);
         return false;
     }
 
     bool ok = XkbWriteXKBKeymap(temp, &result, false, false, NULL, NULL);
-    if (!ok) {
+    /* Closing the stream terminates text with a null byte. */
+    fclose(temp);
+    if (!ok || text == NULL) {
         fprintf(stderr, "[i3lock] XkbWriteXKBKeymap failed\n");
         goto out;
     }
 
-    rewind(temp);
+    uint64_t hash = hash_string(text);
+    if (xkb_state != NULL && hash == last_hash) {
+        DEBUG("keymap unchanged, not recompiling\n");
+        ret = true;
+        goto out;
+    }
 
     if (xkb_context == NULL) {
         if ((xkb_context = xkb_context_new(0)) == NULL) {
@@ -119,49 +205,35 @@ static bool load_keymap(void) {
         }
     }
 
-    if (xkb_keymap != NULL)
-        xkb_keymap_unref(xkb_keymap);
-
-    if ((xkb_keymap = xkb_keymap_new_from_file(xkb_context, temp, XKB_KEYMAP_FORMAT_TEXT_V1, 0)) == NULL) {
-        fprintf(stderr, "[i3lock] xkb_keymap_new_from_file failed\n");
+    struct xkb_keymap *new_keymap = xkb_keymap_new_from_string(xkb_context, text, XKB_KEYMAP_FORMAT_TEXT_V1, 0);
+    if (new_keymap == NULL) {
+        fprintf(stderr, "[i3lock] xkb_keymap_new_from_string failed\n");
         goto out;
     }
 
-    struct xkb_state *new_state = xkb_state_new(xkb_keymap);
+    struct xkb_state *new_state = xkb_state_new(new_keymap);
     if (new_state == NULL) {
         fprintf(stderr, "[i3lock] xkb_state_new failed\n");
+        xkb_keymap_unref(new_keymap);
         goto out;
     }
 
+    if (xkb_keymap != NULL)
+        xkb_keymap_unref(xkb_keymap);
+    xkb_keymap = new_keymap;
+
     if (xkb_state != NULL)
         xkb_state_unref(xkb_state);
     xkb_state = new_state;
 
+    last_hash = hash;
     ret = true;
 out:
     XkbFreeKeyboard(result.xkb, XkbAllComponentsMask, true);
-    fclose(temp);
+    free(text);
     return ret;
 }
 
-/*
- * Clears the memory which stored the password to be a bit safer against
- * cold-boot attacks.
- *
- */
-static void clear_password_memory(void) {
-    /* A volatile pointer to the password buffer to prevent the compiler from
-     * optimizing this out. */
-    volatile char *vpassword = password;
-    for (int c = 0; c < sizeof(password); c++)
-        /* We store a non-random pattern which consists of the (irrelevant)
-         * index plus (!) the value of the beep variable. This prevents the
-         * compiler from optimizing the calls away, since the value of 'beep'
-         * is not known at compile-time. */
-        vpassword[c] = c + (int)beep;
-}
-
-
 /*
  * Resets pam_state to STATE_PAM_IDLE 2 seconds after an unsuccesful
  * authentication event.
@@ -172,173 +244,499 @@ static void clear_pam_wrong(EV_P_ ev_timer *w, int revents) {
     pam_state = STATE_PAM_IDLE;
     unlock_state = STATE_STARTED;
     redraw_screen();
+}
 
-    /* Now free this timeout. */
-    ev_timer_stop(main_loop, clear_pam_wrong_timeout);
-    free(clear_pam_wrong_timeout);
-    clear_pam_wrong_timeout = NULL;
+static void stop_clear_pam_wrong_timeout(void) {
+    ev_timer_stop(main_loop, &clear_pam_wrong_timeout);
 }
 
-static void clear_input(void) {
-    input_position = 0;
-    clear_password_memory();
-    password[input_position] = '\0';
+/*
+ * Turns off the screen using DPMS, unless we already did and there was no
+ * input since.
+ *
+ */
+static void turn_off_screen(void) {
+    if (screen_off)
+        return;
 
-    /* Hide the unlock indicator after a bit if the password buffer is
-     * empty. */
-    start_clear_indicator_timeout();
-    unlock_state = STATE_BACKSPACE_ACTIVE;
-    redraw_screen();
-    unlock_state = STATE_KEY_PRESSED;
+    /* DPMS might be disabled in the X server, it needs to be enabled once. */
+    if (!dpms_enabled) {
+        xcb_dpms_enable(conn);
+        dpms_requests++;
+        dpms_enabled = true;
+    }
+
+    dpms_turn_off_screen(conn);
+    dpms_requests++;
+    screen_off = true;
+    DEBUG("turned off the screen\n");
 }
 
-static void input_done(void) {
-    if (clear_pam_wrong_timeout) {
-        ev_timer_stop(main_loop, clear_pam_wrong_timeout);
-        free(clear_pam_wrong_timeout);
-        clear_pam_wrong_timeout = NULL;
+/*
+ * Turns off the screen dpms_timeout seconds after the last input. Like the
+ * highlight timer, the timer is not re-armed on every key, it checks when it
+ * expires whether there was input in the meantime.
+ *
+ */
+static void dpms_timeout_cb(EV_P_ ev_timer *w, int revents) {
+    ev_tstamp remaining = last_input + dpms_timeout - ev_now(main_loop);
+    if (remaining > 0) {
+        ev_timer_set(w, remaining, 0.);
+        ev_timer_start(main_loop, w);
+        return;
     }
 
-    pam_state = STATE_PAM_VERIFY;
-    redraw_screen();
+    turn_off_screen();
+}
 
-#ifdef BACKEND_WAYLAND
-    /* block until the screen is actually redrawn */
-    window_await_frame(window);
-    window_await_frame(window);
-#endif
+static void start_dpms_timer(void) {
+    if (!ev_is_active(&dpms_timer)) {
+        ev_timer_init(&dpms_timer, dpms_timeout_cb, dpms_timeout, 0.);
+        ev_timer_start(main_loop, &dpms_timer);
+    }
+}
 
-    if (pam_authenticate(pam_handle, 0) == PAM_SUCCESS) {
-        DEBUG("successfully authenticated\n");
-        clear_password_memory();
-        exit(0);
+/*
+ * Called for every key press and release. Any input turns the screen back on
+ * (the X server does that), and it is turned off again dpms_timeout seconds
+ * after the last input, unless a password is being entered.
+ *
+ */
+static void dpms_handle_input(void) {
+    if (!dpms)
+        return;
+
+    screen_off = false;
+    last_input = ev_now(main_loop);
+
+    if (input_position != 0) {
+        ev_timer_stop(main_loop, &dpms_timer);
+        return;
     }
 
-    if (debug_mode)
-        fprintf(stderr, "Authentication failure\n");
+    start_dpms_timer();
+}
 
-    pam_state = STATE_PAM_WRONG;
-    clear_input();
-    redraw_screen();
+/*
+ * Called whenever the password is cleared (Escape, Ctrl-U, a wrong
+ * password). The key release which would arm the timer might have arrived
+ * while the password was not empty yet, so the timer is armed here, counting
+ * from now.
+ *
+ */
+static void dpms_handle_clear(void) {
+    if (!dpms)
+        return;
 
-    /* Clear this state after 2 seconds (unless the user enters another
-     * password during that time). */
-    ev_now_update(main_loop);
-    if ((clear_pam_wrong_timeout = calloc(sizeof(struct ev_timer), 1))) {
-        ev_timer_init(clear_pam_wrong_timeout, clear_pam_wrong, 2.0, 0.);
-        ev_timer_start(main_loop, clear_pam_wrong_timeout);
+    last_input = ev_now(main_loop);
+    start_dpms_timer();
+}
+
+
+/*
+ * Sends READY=1 to the service manager (see sd_notify(3)), if we were started
+ * by one which expects that.
+ *
+ */
+static void notify_service_manager(void) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    const char *path = getenv("NOTIFY_SOCKET");
+    size_t len;
+    int fd;
+
+    if (path == NULL)
+        return;
+
+    len = strlen(path);
+    if ((path[0] != '/' && path[0] != '@') || len >= sizeof(addr.sun_path))
+        return;
+
+    memcpy(addr.sun_path, path, len);
+    /* A leading @ stands for the abstract namespace. */
+    if (addr.sun_path[0] == '@')
+        addr.sun_path[0] = '\0';
+
+    if ((fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) == -1)
+        return;
+    if (sendto(fd, "READY=1", strlen("READY=1"), MSG_NOSIGNAL,
+               (struct sockaddr *)&addr, offsetof(struct sockaddr_un, sun_path) + len) == -1)
+        DEBUG("could not notify the service manager: %s\n", strerror(errno));
+    close(fd);
+
+    unsetenv("NOTIFY_SOCKET");
+}
+
+/*
+ * Tells whoever started us that the screen is locked (or, in daemon mode,
+ * ready to be locked): a newline is written to --ready-fd, which is closed
+ * afterwards, and the service manager is notified. Only the first call does
+ * anything.
+ *
+ */
+static void notify_ready(void) {
+    if (ready_fd != -1) {
+        if (write(ready_fd, "\n", 1) == -1)
+            DEBUG("could not write to --ready-fd: %s\n", strerror(errno));
+        close(ready_fd);
+        ready_fd = -1;
     }
 
-    /* Cancel the clear_indicator_timeout, it would hide the unlock indicator
-     * too early. */
-    stop_clear_indicator_timeout();
+    notify_service_manager();
+}
 
 #ifndef BACKEND_WAYLAND
-    /* beep on authentication failure, if enabled */
-    if (beep) {
-        xcb_bell(conn, 100);
-        xcb_flush(conn);
+/*
+ * Replaces the background image with a blurred screenshot (-B). Must be
+ * called while the lock window is not mapped.
+ *
+ */
+static void take_screenshot(void) {
+    uint64_t start = now_ns();
+    cairo_surface_t *screenshot = capture_root_window(conn, screen);
+    if (screenshot == NULL) {
+        /* Never show the screenshot of the last lock (daemon mode) again, it
+         * might show something else than the screen does now. */
+        if (img != NULL && img_is_screenshot) {
+            cairo_surface_destroy(img);
+            img = NULL;
+        }
+        return;
     }
-#endif
+
+    uint64_t captured = now_ns();
+    blur_image_surface(screenshot, blur_radius);
+    DEBUG("captured the screen in %.1f ms, blurred it in %.1f ms\n",
+          (captured - start) / 1e6, (now_ns() - captured) / 1e6);
+    apply_effects(screenshot);
+
+    if (img != NULL)
+        cairo_surface_destroy(img);
+    img = screenshot;
+    img_is_screenshot = true;
+    tile = false;
+    /* The screenshot cannot be re-read like an image file, so --low-memory
+     * must not try to reload it. */
+    free(image_path);
+    image_path = NULL;
 }
 
 /*
- * Called when the user releases a key. We need to leave the Mode_switch
- * state when the user releases the Mode_switch key.
+ * Maps the lock window and grabs pointer and keyboard, and returns once the
+ * X server has processed that. Everything else
+ * (background, keymap, cursor, PAM) was prepared at startup, so in daemon mode
+ * this is all that locking takes — except for a new screenshot with -B.
+ *
+ * Returns false if pointer and keyboard could not be grabbed (e.g. because
+ * another client holds a grab). In daemon mode, the window is unmapped again
+ * and the next request can be tried, otherwise i3lock exits.
  *
  */
-static void handle_key_release(xcb_key_release_event_t *event) {
-    xkb_state_update_key(xkb_state, event->detail, XKB_KEY_UP);
+static bool lock_screen(void) {
+    if (locked)
+        return true;
+
+    uint64_t start = now_ns();
+
+    if (daemon_mode && blur_radius > 0) {
+        take_screenshot();
+        redraw_background();
+    }
+
+    pam_state = STATE_PAM_IDLE;
+    unlock_state = STATE_STARTED;
+
+    map_fullscreen_window(conn, win);
+    if (!grab_pointer_and_keyboard(conn, screen, cursor)) {
+        if (!daemon_mode)
+            errx(EXIT_FAILURE, "Cannot grab pointer/keyboard");
+        fprintf(stderr, "Cannot grab pointer/keyboard, the screen is not locked\n");
+        xcb_unmap_window(conn, win);
+        x_flush(conn);
+        return false;
+    }
+
+    /* Wait until the X server has processed the map (and painted the
+     * background), so that the screen is locked for real when we return. */
+    free(WAIT_REPLY(xcb_get_input_focus_reply(conn, xcb_get_input_focus(conn), NULL)));
+    locked = true;
+    DEBUG("locked the screen in %.1f ms\n", (now_ns() - start) / 1e6);
+    if (!daemon_mode)
+        DEBUG("screen locked %.1f ms after starting\n", (now_ns() - start_time) / 1e6);
+
+    notify_ready();
+
+    if (dpms) {
+        screen_off = false;
+        turn_off_screen();
+    }
+
+    return true;
 }
 
-static void redraw_timeout(EV_P_ ev_timer *w, int revents) {
+/*
+ * Unmaps the lock window after a successful authentication in daemon mode and
+ * resets the state for the next time the screen is locked.
+ *
+ */
+static void unlock_screen(void) {
+    input_position = 0;
+    password[0] = '\0';
+    stop_clear_pam_wrong_timeout();
+    stop_clear_indicator_timeout();
+
+    pam_state = STATE_PAM_IDLE;
+    unlock_state = STATE_STARTED;
     redraw_screen();
 
-    ev_timer_stop(main_loop, w);
-    free(w);
+    ev_timer_stop(main_loop, &dpms_timer);
+    ungrab_pointer_and_keyboard(conn);
+    xcb_unmap_window(conn, win);
+    x_flush(conn);
+    locked = false;
 }
 
-static void handle_key_press_core(struct xkb_state *xkb_state, xkb_keycode_t key, xkb_keysym_t ksym) {
-    char buffer[128];
-    int n;
-    bool ctrl;
+/*
+ * Locks the screen when receiving SIGUSR1 (daemon mode only).
+ *
+ */
+static void lock_signal_cb(EV_P_ ev_signal *w, int revents) {
+    lock_screen();
+}
 
-    ctrl = xkb_state_mod_name_is_active(xkb_state, "Control", XKB_STATE_MODS_DEPRESSED);
-    xkb_state_update_key(xkb_state, key, XKB_KEY_DOWN);
+#ifdef WITH_LOGIND
+/*
+ * Locks the screen before the system suspends (daemon mode only). If that
+ * fails, the suspend is not held up any longer, there is nothing else to try.
+ *
+ */
+static void before_sleep_cb(void) {
+    lock_screen();
+}
+#endif
 
-    /* The buffer will be null-terminated, so n >= 2 for 1 actual character. */
-    memset(buffer, '\0', sizeof(buffer));
-    n = xkb_keysym_to_utf8(ksym, buffer, sizeof(buffer));
+/* A connection to the control socket. The command is read as it arrives,
+ * the event loop never waits for a client. */
+typedef struct socket_client {
+    struct ev_io watcher;
+    /* Clients which do not send a complete command within a second are
+     * disconnected. */
+    struct ev_timer timeout;
+    char command[32];
+    size_t length;
+} socket_client_t;
+
+static void close_client(socket_client_t *client) {
+    ev_io_stop(main_loop, &client->watcher);
+    ev_timer_stop(main_loop, &client->timeout);
+    close(client->watcher.fd);
+    free(client);
+}
 
-    switch (ksym) {
-    case XKB_KEY_Return:
-    case XKB_KEY_KP_Enter:
-    case XKB_KEY_XF86ScreenSaver:
-        password[input_position] = '\0';
-        unlock_state = STATE_KEY_PRESSED;
-        redraw_screen();
-        input_done();
-        return;
+static void client_timeout_cb(EV_P_ ev_timer *w, int revents) {
+    close_client((socket_client_t *)((char *)w - offsetof(socket_client_t, timeout)));
+}
 
-    case XKB_KEY_u:
-        if (ctrl)
-            clear_input();
+/*
+ * Reads from a connection to the control socket (daemon mode only). The only
+ * command is "lock", which is answered with "locked" once pointer and
+ * keyboard are grabbed, so that the caller (e.g. a suspend hook) can wait for
+ * that, or with "failed" if they could not be grabbed. The command ends with
+ * a newline or when the client shuts down its side of the connection.
+ *
+ */
+static void client_read_cb(EV_P_ ev_io *w, int revents) {
+    socket_client_t *client = (socket_client_t *)w;
+    ssize_t n = read(w->fd, client->command + client->length,
+                     sizeof(client->command) - 1 - client->length);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR))
         return;
+    if (n > 0) {
+        client->length += n;
+        client->command[client->length] = '\0';
+        if (strpbrk(client->command, "\r\n") == NULL &&
+            client->length < sizeof(client->command) - 1)
+            return;
+    }
 
-    case XKB_KEY_Escape:
-        clear_input();
-        return;
+    if (client->length > 0) {
+        const char *answer = "unknown command\n";
+        client->command[strcspn(client->command, "\r\n")] = '\0';
+        if (strcmp(client->command, "lock") == 0)
+            answer = (lock_screen() ? "locked\n" : "failed\n");
+        send(w->fd, answer, strlen(answer), MSG_NOSIGNAL);
+    }
 
-    case XKB_KEY_BackSpace:
-        if (input_position == 0)
-            return;
+    close_client(client);
+}
 
-        /* decrement input_position to point to the previous glyph */
-        u8_dec(password, &input_position);
-        password[input_position] = '\0';
+/*
+ * Accepts a connection to the control socket, which is then read from by
+ * client_read_cb() whenever something arrives.
+ *
+ */
+static void socket_accept_cb(EV_P_ ev_io *w, int revents) {
+    int fd = accept4(w->fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd == -1)
+        return;
 
-        /* Hide the unlock indicator after a bit if the password buffer is
-         * empty. */
-        start_clear_indicator_timeout();
-        unlock_state = STATE_BACKSPACE_ACTIVE;
-        redraw_screen();
-        unlock_state = STATE_KEY_PRESSED;
+    socket_client_t *client = calloc(1, sizeof(socket_client_t));
+    if (client == NULL) {
+        close(fd);
         return;
     }
 
-    if ((input_position + 8) >= sizeof(password))
-        return;
+    ev_io_init(&client->watcher, client_read_cb, fd, EV_READ);
+    ev_io_start(main_loop, &client->watcher);
+    ev_timer_init(&client->timeout, client_timeout_cb, 1., 0.);
+    ev_timer_start(main_loop, &client->timeout);
+}
+
+static void remove_socket(void) {
+    unlink(socket_path);
+}
 
-#if 0
-    /* FIXME: handle all of these? */
-    printf("is_keypad_key = %d\n", xcb_is_keypad_key(sym));
-    printf("is_private_keypad_key = %d\n", xcb_is_private_keypad_key(sym));
-    printf("xcb_is_cursor_key = %d\n", xcb_is_cursor_key(sym));
-    printf("xcb_is_pf_key = %d\n", xcb_is_pf_key(sym));
-    printf("xcb_is_function_key = %d\n", xcb_is_function_key(sym));
-    printf("xcb_is_misc_function_key = %d\n", xcb_is_misc_function_key(sym));
-    printf("xcb_is_modifier_key = %d\n", xcb_is_modifier_key(sym));
+/*
+ * Creates the control socket at $XDG_RUNTIME_DIR/i3lock.sock (daemon mode
+ * only). Returns the listening file descriptor or -1. Exits if another daemon
+ * is listening on it already.
+ *
+ */
+static int listen_on_socket(void) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    int fd;
+
+    if (dir == NULL || asprintf(&socket_path, "%s/i3lock.sock", dir) == -1) {
+        socket_path = NULL;
+        return -1;
+    }
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, socket_path);
+
+    /* A socket left behind by a crashed i3lock would make bind() fail. It is
+     * only removed if nobody listens on it, a running daemon keeps its socket
+     * (a full backlog makes the non-blocking connect() fail with EAGAIN). */
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) == -1)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 || errno == EAGAIN)
+        errx(EXIT_FAILURE, "Another i3lock daemon is running (it listens on %s)", socket_path);
+    if (errno == ECONNREFUSED)
+        unlink(socket_path);
+    close(fd);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+        return -1;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(fd, 4) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    atexit(remove_socket);
+    return fd;
+}
 #endif
 
-    if (n < 2)
-        return;
+/*
+ * Runs pam_authenticate() in a separate thread, so that the event loop keeps
+ * running (and animating the unlock indicator) while PAM verifies the
+ * password, which can take seconds with LDAP or pam_faildelay. The main thread
+ * ignores key presses in the meantime, so the password buffer is not modified
+ * while PAM reads it in conv_callback.
+ *
+ */
+static void *authenticate(void *arg) {
+    auth_result = pam_authenticate(pam_handle, 0);
+    ev_async_send(main_loop, &auth_done);
+    return NULL;
+}
+
+/*
+ * Called in the main thread once the authentication thread is done.
+ *
+ */
+static void auth_done_cb(EV_P_ ev_async *w, int revents) {
+    if (auth_thread_running) {
+        pthread_join(auth_thread, NULL);
+        auth_thread_running = false;
+    }
+    stop_verify_spinner();
+
+    histogram_add(&auth_time, (now_ns() - auth_start) / 1000000);
+    histogram_add(&auth_frames, drawn_frames() - auth_start_frames);
+    histogram_add(&auth_keys, auth_keys_pressed);
+
+    if (auth_result == PAM_SUCCESS) {
+        DEBUG("successfully authenticated\n");
+        clear_password_memory();
+#ifndef BACKEND_WAYLAND
+        if (daemon_mode) {
+            unlock_screen();
+            histogram_add(&unlock_time, (now_ns() - auth_start) / 1000000);
+            return;
+        }
+#endif
+        histogram_add(&unlock_time, (now_ns() - auth_start) / 1000000);
+        exit(0);
+    }
 
-    /* store it in the password array as UTF-8 */
-    memcpy(password+input_position, buffer, n-1);
-    input_position += n-1;
-    DEBUG("current password = %.*s\n", input_position, password);
+    if (debug_mode)
+        fprintf(stderr, "Authentication failure\n");
 
-    unlock_state = STATE_KEY_ACTIVE;
+    pam_state = STATE_PAM_WRONG;
+    clear_input();
     redraw_screen();
-    unlock_state = STATE_KEY_PRESSED;
 
-    struct ev_timer *timeout = calloc(sizeof(struct ev_timer), 1);
-    if (timeout) {
-        ev_timer_init(timeout, redraw_timeout, 0.25, 0.);
-        ev_timer_start(main_loop, timeout);
+    /* Clear this state after 2 seconds (unless the user enters another
+     * password during that time). */
+    ev_now_update(main_loop);
+    ev_timer_init(&clear_pam_wrong_timeout, clear_pam_wrong, 2.0, 0.);
+    ev_timer_start(main_loop, &clear_pam_wrong_timeout);
+
+    /* Cancel the clear_indicator_timeout, it would hide the unlock indicator
+     * too early. */
+    stop_clear_indicator_timeout();
+
+#ifndef BACKEND_WAYLAND
+    /* beep on authentication failure, if enabled */
+    if (beep) {
+        xcb_bell(conn, 100);
+        x_flush(conn);
     }
+#endif
+}
+
+static void input_done(void) {
+    stop_clear_pam_wrong_timeout();
 
+    /* The unlock indicator has to stay visible while verifying. */
     stop_clear_indicator_timeout();
+
+    pam_state = STATE_PAM_VERIFY;
+    redraw_screen();
+    start_verify_spinner();
+
+    auth_start = now_ns();
+    auth_start_frames = drawn_frames();
+    auth_keys_pressed = 0;
+
+    if (pthread_create(&auth_thread, NULL, authenticate, NULL) == 0) {
+        auth_thread_running = true;
+    } else {
+        /* Without a thread, we verify synchronously (the spinner will not
+         * move, but the screen stays locked). */
+        authenticate(NULL);
+    }
+}
+
+/*
+ * Called when the user releases a key. We need to leave the Mode_switch
+ * state when the user releases the Mode_switch key.
+ *
+ */
+static void handle_key_release(xcb_key_release_event_t *event) {
+    xkb_state_update_key(xkb_state, event->detail, XKB_KEY_UP);
 }
 
 /*
@@ -348,6 +746,16 @@ static void handle_key_press_core(struct xkb_state *xkb_state, xkb_keycode_t key
  *
  */
 static void handle_key_press(xcb_key_press_event_t *event) {
+    uint64_t start = now_ns();
+
+    /* The X server timestamps events in milliseconds of its monotonic clock.
+     * For a local X server, that is the same clock as ours, so the difference
+     * is how long the event was queued before we handled it. For remote X
+     * servers, the values are meaningless, so we ignore implausible ones. */
+    uint32_t queued = (uint32_t)(start / 1000000) - event->time;
+    if (queued < 10000)
+        histogram_add(&key_queue_time, queued);
+
     handle_key_press_core(xkb_state, event->detail, xkb_state_key_get_one_sym(xkb_state, event->detail));
 }
 
@@ -364,18 +772,23 @@ static void handle_visibility_notify(xcb_visibility_notify_event_t *event) {
     if (event->state != XCB_VISIBILITY_UNOBSCURED) {
         uint32_t values[] = { XCB_STACK_MODE_ABOVE };
         xcb_configure_window(conn, event->window, XCB_CONFIG_WINDOW_STACK_MODE, values);
-        xcb_flush(conn);
+        x_flush(conn);
     }
 }
 
 /*
- * Called when the keyboard mapping changes. We update our symbols.
+ * Called when the keyboard mapping changes. Changing the layout or running
+ * xmodmap generates a burst of these events, so we only remember that the
+ * keymap has to be reloaded and do that once, after all pending events were
+ * handled (see xcb_prepare_cb()). Pointer mapping changes do not affect the
+ * keymap. Modifier mapping changes do, the modifier map is part of it.
  *
  */
 static void handle_mapping_notify(xcb_mapping_notify_event_t *event) {
-    /* We ignore errors — if the new keymap cannot be loaded it’s better if the
-     * screen stays locked and the user intervenes by using killall i3lock. */
-    (void)load_keymap();
+    if (event->request == XCB_MAPPING_POINTER)
+        return;
+
+    keymap_reload_pending = true;
 }
 
 /*
@@ -388,7 +801,7 @@ void handle_screen_resize(void) {
     xcb_get_geometry_cookie_t geomc;
     xcb_get_geometry_reply_t *geom;
     geomc = xcb_get_geometry(conn, screen->root);
-    if ((geom = xcb_get_geometry_reply(conn, geomc, 0)) == NULL)
+    if ((geom = WAIT_REPLY(xcb_get_geometry_reply(conn, geomc, 0))) == NULL)
         return;
 
     if (last_resolution[0] == geom->width &&
@@ -402,14 +815,11 @@ void handle_screen_resize(void) {
 
     free(geom);
 
-    redraw_screen();
-
     uint32_t mask = XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
     xcb_configure_window(conn, win, mask, last_resolution);
-    xcb_flush(conn);
 
     xinerama_query_screens();
-    redraw_screen();
+    redraw_background();
 }
 
 /*
@@ -429,14 +839,21 @@ static int conv_callback(int num_msg, const struct pam_message **msg,
     }
 
     for (int c = 0; c < num_msg; c++) {
+        DEBUG("PAM message %d/%d (style %d): %s\n", c + 1, num_msg, msg[c]->msg_style, msg[c]->msg);
         if (msg[c]->msg_style != PAM_PROMPT_ECHO_OFF &&
             msg[c]->msg_style != PAM_PROMPT_ECHO_ON)
             continue;
 
         /* return code is currently not used but should be set to zero */
-        resp[c]->resp_retcode = 0;
-        if ((resp[c]->resp = strdup(password)) == NULL) {
-            perror("strdup");
+        (*resp)[c].resp_retcode = 0;
+        /* The copy lives in the secure arena as well. PAM frees it with
+         * free(), which wipes it (see secure.c). */
+        if (((*resp)[c].resp = secure_strdup(password)) == NULL) {
+            fprintf(stderr, "No room for the PAM response in the secure arena\n");
+            for (int i = 0; i < c; i++)
+                free((*resp)[i].resp);
+            free(*resp);
+            *resp = NULL;
             return 1;
         }
     }
@@ -445,86 +862,143 @@ static int conv_callback(int num_msg, const struct pam_message **msg,
 }
 
 /*
- * This callback is only a dummy, see xcb_prepare_cb and xcb_check_cb.
- * See also man libev(3): "ev_prepare" and "ev_check" - customise your event loop
+ * Prints all statistics which were collected so far (debug mode only).
  *
  */
-static void xcb_got_event(EV_P_ struct ev_io *w, int revents) {
-    /* empty, because xcb_prepare_cb and xcb_check_cb are used */
+static void print_stats(void) {
+    histogram_print(&key_queue_time);
+    histogram_print(&key_handler_time);
+    histogram_print(&key_handler_render_time);
+    histogram_print(&auth_time);
+    histogram_print(&unlock_time);
+    histogram_print(&auth_frames);
+    histogram_print(&auth_keys);
+    print_render_stats();
+#ifndef BACKEND_WAYLAND
+    x_traffic_print(conn);
+#endif
+    if (dpms)
+        printf("[i3lock-debug] DPMS requests: %d\n", dpms_requests);
+    printf("[i3lock-debug] resident memory: %ld KiB\n", resident_memory_kib());
+    fflush(stdout);
 }
 
 /*
- * Flush before blocking (and waiting for new events)
+ * Prints the statistics when receiving SIGUSR2 (debug mode only).
  *
  */
-static void xcb_prepare_cb(EV_P_ ev_prepare *w, int revents) {
-    xcb_flush(conn);
+static void print_stats_cb(EV_P_ ev_signal *w, int revents) {
+    print_stats();
 }
 
 /*
- * Instead of polling the X connection socket we leave this to
- * xcb_poll_for_event() which knows better than we can ever know.
+ * Handles one X11 event and frees it.
  *
  */
-static void xcb_check_cb(EV_P_ ev_check *w, int revents) {
-    xcb_generic_event_t *event;
+static void handle_xcb_event(xcb_generic_event_t *event) {
+    if (event->response_type == 0) {
+        xcb_generic_error_t *error = (xcb_generic_error_t*)event;
+        if (debug_mode)
+            fprintf(stderr, "X11 Error received! sequence 0x%x, error_code = %d\n",
+                    error->sequence, error->error_code);
+        free(event);
+        return;
+    }
 
-    while ((event = xcb_poll_for_event(conn)) != NULL) {
-        if (event->response_type == 0) {
-            xcb_generic_error_t *error = (xcb_generic_error_t*)event;
-            if (debug_mode)
-                fprintf(stderr, "X11 Error received! sequence 0x%x, error_code = %d\n",
-                        error->sequence, error->error_code);
-            free(event);
-            continue;
-        }
+    /* Strip off the highest bit (set if the event is generated) */
+    int type = (event->response_type & 0x7F);
+    switch (type) {
+        case XCB_KEY_PRESS:
+            handle_key_press((xcb_key_press_event_t*)event);
+            dpms_handle_input();
+            break;
 
-        /* Strip off the highest bit (set if the event is generated) */
-        int type = (event->response_type & 0x7F);
-        switch (type) {
-            case XCB_KEY_PRESS:
-                handle_key_press((xcb_key_press_event_t*)event);
-                break;
+        case XCB_KEY_RELEASE:
+            handle_key_release((xcb_key_release_event_t*)event);
+            dpms_handle_input();
+            break;
 
-            case XCB_KEY_RELEASE:
-                handle_key_release((xcb_key_release_event_t*)event);
+        case XCB_VISIBILITY_NOTIFY:
+            handle_visibility_notify((xcb_visibility_notify_event_t*)event);
+            break;
 
-                /* If this was the backspace or escape key we are back at an
-                 * empty input, so turn off the screen if DPMS is enabled */
-                if (dpms && input_position == 0)
-                    dpms_turn_off_screen(conn);
+        case XCB_MAP_NOTIFY:
+            if (!dont_fork) {
+                /* After the first MapNotify, we never fork again. We don’t
+                 * expect to get another MapNotify, but better be sure… */
+                dont_fork = true;
+
+                /* In the parent process, we exit. Without the atexit()
+                 * handlers: print_stats() would talk to the X server on the
+                 * connection which the child now uses (and its buffered
+                 * output is printed by the child anyway). */
+                if (fork() != 0)
+                    _exit(0);
+
+                ev_loop_fork(EV_DEFAULT);
+                start_render_thread();
+            }
+            break;
 
-                break;
+        case XCB_MAPPING_NOTIFY:
+            handle_mapping_notify((xcb_mapping_notify_event_t*)event);
+            break;
 
-            case XCB_VISIBILITY_NOTIFY:
-                handle_visibility_notify((xcb_visibility_notify_event_t*)event);
-                break;
+        case XCB_CONFIGURE_NOTIFY:
+            handle_screen_resize();
+            break;
+    }
 
-            case XCB_MAP_NOTIFY:
-                if (!dont_fork) {
-                    /* After the first MapNotify, we never fork again. We don’t
-                     * expect to get another MapNotify, but better be sure… */
-                    dont_fork = true;
+    free(event);
+}
 
-                    /* In the parent process, we exit */
-                    if (fork() != 0)
-                        exit(0);
+/*
+ * Reads and handles all events once the X11 connection is readable.
+ *
+ */
+static void xcb_got_event(EV_P_ struct ev_io *w, int revents) {
+    xcb_generic_event_t *event;
 
-                    ev_loop_fork(EV_DEFAULT);
-                }
-                break;
+    while ((event = xcb_poll_for_event(conn)) != NULL)
+        handle_xcb_event(event);
+}
 
-            case XCB_MAPPING_NOTIFY:
-                handle_mapping_notify((xcb_mapping_notify_event_t*)event);
-                break;
+/*
+ * Handles the events which xcb already read from the socket while we were
+ * waiting for a reply (e.g. in grab_pointer_and_keyboard()). The socket is
+ * not readable for those anymore. Unlike xcb_poll_for_event(), this does not
+ * try to read from the socket, so it costs no syscall.
+ *
+ */
+static void xcb_check_cb(EV_P_ ev_check *w, int revents) {
+    xcb_generic_event_t *event;
 
-            case XCB_CONFIGURE_NOTIFY:
-                handle_screen_resize();
-                break;
-        }
+    while ((event = xcb_poll_for_queued_event(conn)) != NULL)
+        handle_xcb_event(event);
+}
 
-        free(event);
+/*
+ * Reloads the keymap if necessary, then flushes before blocking (and waiting
+ * for new events). Flushing costs no syscall when there is nothing to flush.
+ *
+ */
+static void xcb_prepare_cb(EV_P_ ev_prepare *w, int revents) {
+    while (keymap_reload_pending) {
+        keymap_reload_pending = false;
+        /* We ignore errors — if the new keymap cannot be loaded it’s better if
+         * the screen stays locked and the user intervenes by using killall
+         * i3lock. */
+        (void)load_keymap();
+
+        /* Fetching the keymap waited for replies, during which xcb might have
+         * queued new events. We would not get to those before the next
+         * wakeup, so handle them now. */
+        xcb_generic_event_t *event;
+        while ((event = xcb_poll_for_queued_event(conn)) != NULL)
+            handle_xcb_event(event);
     }
+
+    x_flush(conn);
 }
 
 #ifdef BACKEND_WAYLAND
@@ -551,9 +1025,9 @@ static void wayland_key_press(struct input *input, uint32_t time, uint32_t key,
 
 int main(int argc, char *argv[]) {
     char *username;
-    char *image_path = NULL;
     int ret;
     struct pam_conv conv = {conv_callback, NULL};
+    start_time = now_ns();
     int curs_choice = CURS_NONE;
     int o;
     int optind = 0;
@@ -569,13 +1043,22 @@ int main(int argc, char *argv[]) {
         {"no-unlock-indicator", no_argument, NULL, 'u'},
         {"image", required_argument, NULL, 'i'},
         {"tiling", no_argument, NULL, 't'},
+        {"low-memory", no_argument, NULL, 0},
+        {"theme", required_argument, NULL, 0},
+        {"blur", required_argument, NULL, 'B'},
+        {"effect", required_argument, NULL, 'e'},
+        {"daemon", no_argument, NULL, 0},
+        {"ready-fd", required_argument, NULL, 0},
+        {"image-fd", required_argument, NULL, 0},
+        {"dpms-timeout", required_argument, NULL, 0},
+        {"pam-service", required_argument, NULL, 0},
         {NULL, no_argument, NULL, 0}
     };
 
     if ((username = getenv("USER")) == NULL)
         errx(1, "USER environment variable not set, please set it.\n");
 
-    while ((o = getopt_long(argc, argv, "hvnbdc:p:ui:t", longopts, &optind)) != -1) {
+    while ((o = getopt_long(argc, argv, "hvnbdc:p:ui:tB:e:", longopts, &optind)) != -1) {
         switch (o) {
         case 'v':
             errx(EXIT_SUCCESS, "version " VERSION " © 2010-2012 Michael Stapelberg");
@@ -609,6 +1092,18 @@ int main(int argc, char *argv[]) {
         case 't':
             tile = true;
             break;
+        case 'B': {
+            char *end;
+            long radius = strtol(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || radius < 1 || radius > 100)
+                errx(1, "blur radius is invalid, it must be between 1 and 100\n");
+            blur_radius = radius;
+            break;
+        }
+        case 'e':
+            if (!add_effect(optarg))
+                errx(1, "effect \"%s\" is invalid, see the manpage for the available effects\n", optarg);
+            break;
         case 'p':
             if (!strcmp(optarg, "win")) {
                 curs_choice = CURS_WIN;
@@ -621,52 +1116,102 @@ int main(int argc, char *argv[]) {
         case 0:
             if (strcmp(longopts[optind].name, "debug") == 0)
                 debug_mode = true;
+            else if (strcmp(longopts[optind].name, "low-memory") == 0)
+                low_memory = true;
+            else if (strcmp(longopts[optind].name, "theme") == 0)
+                theme_path = strdup(optarg);
+            else if (strcmp(longopts[optind].name, "daemon") == 0)
+                daemon_mode = true;
+            else if (strcmp(longopts[optind].name, "ready-fd") == 0) {
+                char *end;
+                long fd = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || fd < 0 || fd > INT_MAX ||
+                    fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+                    errx(1, "--ready-fd needs an open file descriptor\n");
+                ready_fd = fd;
+            }
+            else if (strcmp(longopts[optind].name, "image-fd") == 0) {
+                char *end;
+                long fd = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || fd < 0 || fd > INT_MAX ||
+                    fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+                    errx(1, "--image-fd needs an open file descriptor\n");
+                image_fd = fd;
+            }
+            else if (strcmp(longopts[optind].name, "dpms-timeout") == 0) {
+                char *end;
+                dpms_timeout = strtod(optarg, &end);
+                if (*optarg == '\0' || *end != '\0' || dpms_timeout < 0)
+                    errx(1, "--dpms-timeout needs a number of seconds\n");
+            }
+            else if (strcmp(longopts[optind].name, "pam-service") == 0)
+                pam_service = strdup(optarg);
             break;
         default:
             errx(1, "Syntax: i3lock [-v] [-n] [-b] [-d] [-c color] [-u] [-p win|default]"
-            " [-i image.png] [-t]"
+            " [-i image.png] [-t] [-B radius] [-e effect[:value]]... [--low-memory] [--theme=file] [--daemon] [--ready-fd=fd] [--image-fd=fd] [--dpms-timeout=seconds] [--pam-service=name]"
             );
         }
     }
 
+    /* Parse all colors once, so that drawing does not have to. */
+    theme_init();
+    if (theme_path != NULL && !theme_load(theme_path))
+        errx(EXIT_FAILURE, "Could not load the theme \"%s\"\n", theme_path);
+    if (color[0] != '\0')
+        theme_set("background", color);
+
+    /* Print how long handling keys and rendering took when exiting (i.e.
+     * after unlocking). */
+    if (debug_mode)
+        atexit(print_stats);
+
     /* We need (relatively) random numbers for highlighting a random part of
      * the unlock indicator upon keypresses. */
     srand(time(NULL));
 
     /* Initialize PAM */
-    ret = pam_start("i3lock", username, &conv, &pam_handle);
+    ret = pam_start(pam_service, username, &conv, &pam_handle);
     if (ret != PAM_SUCCESS)
         errx(EXIT_FAILURE, "PAM: %s", pam_strerror(pam_handle, ret));
 
-/* Using mlock() as non-super-user seems only possible in Linux. Users of other
- * operating systems should use encrypted swap/no swap (or remove the ifdef and
- * run i3lock as super-user). */
-#if defined(__linux__)
     /* Lock the area where we store the password in memory, we don’t want it to
-     * be swapped to disk. Since Linux 2.6.9, this does not require any
-     * privileges, just enough bytes in the RLIMIT_MEMLOCK limit. */
-    if (mlock(password, sizeof(password)) != 0)
+     * be swapped to disk. */
+    if (!secure_arena_init(PASSWORD_SIZE))
         err(EXIT_FAILURE, "Could not lock page in memory, check RLIMIT_MEMLOCK");
-#endif
+    password = secure_alloc(PASSWORD_SIZE);
+    input_init(input_done, dpms_handle_clear);
 
-    if (image_path) {
-        /* Create a pixmap to render on, fill it with the background color */
-        img = cairo_image_surface_create_from_png(image_path);
-        /* In case loading failed, we just pretend no -i was specified. */
-        if (cairo_surface_status(img) != CAIRO_STATUS_SUCCESS) {
-            fprintf(stderr, "Could not load image \"%s\": cairo surface status %d\n",
-                    image_path, cairo_surface_status(img));
-            img = NULL;
-        }
-    }
+    if (image_path != NULL && image_fd != -1)
+        errx(EXIT_FAILURE, "-i and --image-fd cannot be used together\n");
+    if (image_fd != -1) {
+        img = load_raw_image(image_fd);
+        apply_effects(img);
+    } else if (image_path)
+        load_image();
 
     /* Initialize the libev event loop. */
     main_loop = EV_DEFAULT;
     if (main_loop == NULL)
         errx(EXIT_FAILURE, "Could not initialize libev. Bad LIBEV_FLAGS?\n");
 
+    /* The authentication thread notifies the event loop when it is done. */
+    ev_async_init(&auth_done, auth_done_cb);
+    ev_async_start(main_loop, &auth_done);
+
+    /* In debug mode, the statistics can be printed at any time by sending
+     * SIGUSR2. */
+    if (debug_mode) {
+        struct ev_signal *stats_signal = calloc(sizeof(struct ev_signal), 1);
+        ev_signal_init(stats_signal, print_stats_cb, SIGUSR2);
+        ev_signal_start(main_loop, stats_signal);
+    }
+
 #ifdef BACKEND_WAYLAND
 
+    if (daemon_mode)
+        errx(EXIT_FAILURE, "--daemon is not supported with the Wayland backend");
+
     wayland_display = create_display();
     if (wayland_display == NULL)
         errx(EXIT_FAILURE, "Could not connect to Wayland, maybe you need to set WAYLAND_DISPLAY?");
@@ -691,8 +1236,17 @@ int main(int argc, char *argv[]) {
      * file descriptor becomes readable). */
     wl_display_dispatch(wayland_display->display);
 
+    /* There is no grab on Wayland, the compositor keeps the input with our
+     * fullscreen surface once it shows it. */
+    notify_ready();
+
 #else
 
+    /* The render thread (see unlock_indicator.c) sends requests on the same
+     * connection which Xlib uses for XKB, so Xlib has to lock its Display. */
+    if (!XInitThreads())
+        errx(EXIT_FAILURE, "Could not initialize Xlib for threads");
+
     /* Initialize connection to X11 */
     if ((display = XOpenDisplay(NULL)) == NULL)
         errx(EXIT_FAILURE, "Could not connect to X11, maybe you need to set DISPLAY?");
@@ -710,11 +1264,14 @@ int main(int argc, char *argv[]) {
     xinerama_init();
     xinerama_query_screens();
 
+    if (debug_mode)
+        x_traffic_phase(conn, "startup: connecting, keymap, screens");
+
     /* if DPMS is enabled, check if the X server really supports it */
     if (dpms) {
         xcb_dpms_capable_cookie_t dpmsc = xcb_dpms_capable(conn);
         xcb_dpms_capable_reply_t *dpmsr;
-        if ((dpmsr = xcb_dpms_capable_reply(conn, dpmsc, NULL))) {
+        if ((dpmsr = WAIT_REPLY(xcb_dpms_capable_reply(conn, dpmsc, NULL)))) {
             if (!dpmsr->capable) {
                 if (debug_mode)
                     fprintf(stderr, "Disabling DPMS, X server not DPMS capable\n");
@@ -732,19 +1289,56 @@ int main(int argc, char *argv[]) {
     xcb_change_window_attributes(conn, screen->root, XCB_CW_EVENT_MASK,
             (uint32_t[]){ XCB_EVENT_MASK_STRUCTURE_NOTIFY });
 
+    /* Take the screenshot before our window covers the screen. It replaces
+     * any image given with -i. In daemon mode, it is taken when locking. */
+    if (blur_radius > 0 && !daemon_mode)
+        take_screenshot();
+
     /* Pixmap on which the image is rendered to (if any) */
     xcb_pixmap_t bg_pixmap = draw_image(last_resolution);
 
     /* open the fullscreen window, already with the correct pixmap in place */
-    win = open_fullscreen_window(conn, screen, color, bg_pixmap);
-    xcb_free_pixmap(conn, bg_pixmap);
+    win = open_fullscreen_window(conn, screen, get_pixel(screen, theme.background.rgb), bg_pixmap);
+
+    /* The unlock indicator is displayed in child windows, so that updating it
+     * does not require touching the background. */
+    position_indicator_windows();
+
+    DEBUG("resident memory after uploading the background: %ld KiB\n", resident_memory_kib());
+    if (debug_mode)
+        x_traffic_phase(conn, "startup: background, windows");
 
     cursor = create_cursor(conn, screen, win, curs_choice);
 
-    grab_pointer_and_keyboard(conn, screen, cursor);
+    if (daemon_mode) {
+        /* There is nothing to fork for, the daemon keeps running. */
+        dont_fork = true;
+
+        struct ev_signal *lock_signal = calloc(sizeof(struct ev_signal), 1);
+        ev_signal_init(lock_signal, lock_signal_cb, SIGUSR1);
+        ev_signal_start(main_loop, lock_signal);
+
+        int socket_fd = listen_on_socket();
+        if (socket_fd != -1) {
+            struct ev_io *socket_watcher = calloc(sizeof(struct ev_io), 1);
+            ev_io_init(socket_watcher, socket_accept_cb, socket_fd, EV_READ);
+            ev_io_start(main_loop, socket_watcher);
+        } else {
+            fprintf(stderr, "Could not create the control socket (is XDG_RUNTIME_DIR set?), "
+                            "only SIGUSR1 locks the screen\n");
+        }
 
-    if (dpms)
-        dpms_turn_off_screen(conn);
+#ifdef WITH_LOGIND
+        /* Lock the screen whenever the system suspends. */
+        logind_init(before_sleep_cb);
+#endif
+        DEBUG("daemon ready, resident memory: %ld KiB\n", resident_memory_kib());
+        notify_ready();
+    } else {
+        lock_screen();
+    }
+    if (debug_mode)
+        x_traffic_phase(conn, "startup: locking");
 
     struct ev_io *xcb_watcher = calloc(sizeof(struct ev_io), 1);
     struct ev_check *xcb_check = calloc(sizeof(struct ev_check), 1);
@@ -759,6 +1353,11 @@ int main(int argc, char *argv[]) {
     ev_prepare_init(xcb_prepare, xcb_prepare_cb);
     ev_prepare_start(main_loop, xcb_prepare);
 
+    /* Without forking, frames can be drawn in the render thread right away.
+     * Otherwise, it is started in the child (see handle_xcb_event()). */
+    if (dont_fork)
+        start_render_thread();
+
     /* Invoke the event callback once to catch all the events which were
      * received up until now. ev will only pick up new events (when the X11
      * file descriptor becomes readable). */
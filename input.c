@@ -0,0 +1,219 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010-2012 Michael Stapelberg
+ *
+ * input.c: turns key presses (of either backend) into the password. Return
+ *          hands it to the callback given to input_init(), which verifies it.
+ *          bench/keys links this file as well, to replay key presses without
+ *          an X server or PAM.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ev.h>
+#include <xcb/xcb.h>
+#include <cairo.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "i3lock.h"
+#include "input.h"
+#include "unlock_indicator.h"
+#include "secure.h"
+#include "stats.h"
+
+extern bool debug_mode;
+extern struct ev_loop *main_loop;
+extern unlock_state_t unlock_state;
+extern pam_state_t pam_state;
+
+int input_position = 0;
+/* Holds the password you enter (in UTF-8). It lives in the secure arena, so
+ * it is never swapped out. */
+char *password;
+uint64_t auth_keys_pressed;
+
+histogram_t key_handler_time = { .name = "key handler incl. render and flush (ns)" };
+histogram_t key_handler_render_time = { .name = "key handler, keys which triggered a redraw (ns)" };
+
+static struct ev_timer highlight_timeout;
+/* When the last key was highlighted, see handle_key_press_input(). */
+static ev_tstamp last_highlight;
+
+/* Called on Return, with the password complete. */
+static void (*input_done_cb)(void);
+/* Called whenever the password is cleared, may be NULL. */
+static void (*input_cleared_cb)(void);
+
+void input_init(void (*done)(void), void (*cleared)(void)) {
+    input_done_cb = done;
+    input_cleared_cb = cleared;
+}
+
+/*
+ * Decrements i to point to the previous unicode glyph
+ *
+ */
+void u8_dec(char *s, int *i) {
+    (void)(isutf(s[--(*i)]) || isutf(s[--(*i)]) || isutf(s[--(*i)]) || --(*i));
+}
+
+/*
+ * Clears the memory which stored the password to be a bit safer against
+ * cold-boot attacks.
+ *
+ */
+void clear_password_memory(void) {
+    secure_wipe(password, PASSWORD_SIZE);
+}
+
+void clear_input(void) {
+    input_position = 0;
+    clear_password_memory();
+    password[input_position] = '\0';
+    if (input_cleared_cb != NULL)
+        input_cleared_cb();
+
+    /* Hide the unlock indicator after a bit if the password buffer is
+     * empty. */
+    start_clear_indicator_timeout();
+    unlock_state = STATE_BACKSPACE_ACTIVE;
+    redraw_screen();
+    unlock_state = STATE_KEY_PRESSED;
+}
+
+/*
+ * Removes the highlight of the last key press from the unlock indicator
+ * 0.25 seconds after it. Instead of re-arming the timer on every key press,
+ * the timer only checks when the last key was pressed and, if that was less
+ * than 0.25 seconds ago, waits for the rest of the time.
+ *
+ */
+static void highlight_timeout_cb(EV_P_ ev_timer *w, int revents) {
+    ev_tstamp remaining = last_highlight + 0.25 - ev_now(main_loop);
+    if (remaining > 0) {
+        ev_timer_set(w, remaining, 0.);
+        ev_timer_start(main_loop, w);
+        return;
+    }
+
+    redraw_screen();
+}
+
+static void handle_key_press_input(struct xkb_state *xkb_state, xkb_keycode_t key, xkb_keysym_t ksym) {
+    char buffer[128];
+    int n;
+    bool ctrl;
+
+    ctrl = xkb_state_mod_name_is_active(xkb_state, "Control", XKB_STATE_MODS_DEPRESSED);
+    xkb_state_update_key(xkb_state, key, XKB_KEY_DOWN);
+
+    /* While PAM is verifying the password, we must not modify it. */
+    if (pam_state == STATE_PAM_VERIFY) {
+        auth_keys_pressed++;
+        return;
+    }
+
+    /* The buffer will be null-terminated, so n >= 2 for 1 actual character. */
+    memset(buffer, '\0', sizeof(buffer));
+    n = xkb_keysym_to_utf8(ksym, buffer, sizeof(buffer));
+
+    switch (ksym) {
+    case XKB_KEY_Return:
+    case XKB_KEY_KP_Enter:
+    case XKB_KEY_XF86ScreenSaver:
+        password[input_position] = '\0';
+        unlock_state = STATE_KEY_PRESSED;
+        redraw_screen();
+        input_done_cb();
+        return;
+
+    case XKB_KEY_u:
+        if (ctrl)
+            clear_input();
+        return;
+
+    case XKB_KEY_Escape:
+        clear_input();
+        return;
+
+    case XKB_KEY_BackSpace:
+        if (input_position == 0)
+            return;
+
+        /* decrement input_position to point to the previous glyph */
+        u8_dec(password, &input_position);
+        password[input_position] = '\0';
+
+        /* Hide the unlock indicator after a bit if the password buffer is
+         * empty. */
+        start_clear_indicator_timeout();
+        unlock_state = STATE_BACKSPACE_ACTIVE;
+        redraw_screen();
+        unlock_state = STATE_KEY_PRESSED;
+        return;
+    }
+
+    if ((input_position + 8) >= PASSWORD_SIZE)
+        return;
+
+#if 0
+    /* FIXME: handle all of these? */
+    printf("is_keypad_key = %d\n", xcb_is_keypad_key(sym));
+    printf("is_private_keypad_key = %d\n", xcb_is_private_keypad_key(sym));
+    printf("xcb_is_cursor_key = %d\n", xcb_is_cursor_key(sym));
+    printf("xcb_is_pf_key = %d\n", xcb_is_pf_key(sym));
+    printf("xcb_is_function_key = %d\n", xcb_is_function_key(sym));
+    printf("xcb_is_misc_function_key = %d\n", xcb_is_misc_function_key(sym));
+    printf("xcb_is_modifier_key = %d\n", xcb_is_modifier_key(sym));
+#endif
+
+    if (n < 2)
+        return;
+
+    /* store it in the password array as UTF-8 */
+    memcpy(password+input_position, buffer, n-1);
+    input_position += n-1;
+    secure_wipe(buffer, sizeof(buffer));
+    DEBUG("current password = %.*s\n", input_position, password);
+
+    unlock_state = STATE_KEY_ACTIVE;
+    redraw_screen();
+    unlock_state = STATE_KEY_PRESSED;
+
+    last_highlight = ev_now(main_loop);
+    if (!ev_is_active(&highlight_timeout)) {
+        ev_timer_init(&highlight_timeout, highlight_timeout_cb, 0.25, 0.);
+        ev_timer_start(main_loop, &highlight_timeout);
+    }
+
+    stop_clear_indicator_timeout();
+}
+
+/*
+ * Handles a key press of either backend and records how long that took. Keys
+ * which did not change the input (modifiers, keys without a UTF-8
+ * representation, …) are cheap, so they are accounted separately from keys
+ * which triggered a redraw. Keys which start authentication are not recorded
+ * at all, since they are dominated by the time PAM takes.
+ *
+ */
+void handle_key_press_core(struct xkb_state *xkb_state, xkb_keycode_t key, xkb_keysym_t ksym) {
+    uint64_t start = now_ns();
+    int old_position = input_position;
+
+    handle_key_press_input(xkb_state, key, ksym);
+
+    if (ksym == XKB_KEY_Return ||
+        ksym == XKB_KEY_KP_Enter ||
+        ksym == XKB_KEY_XF86ScreenSaver)
+        return;
+
+    uint64_t duration = now_ns() - start;
+    histogram_add(&key_handler_time, duration);
+    if (input_position != old_position)
+        histogram_add(&key_handler_render_time, duration);
+}
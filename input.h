@@ -0,0 +1,28 @@
+#ifndef _INPUT_H
+#define _INPUT_H
+
+#include <stdint.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "stats.h"
+
+/* The size of the password buffer, in bytes of UTF-8. */
+#define PASSWORD_SIZE 512
+
+/* isutf, u8_dec © 2005 Jeff Bezanson, public domain */
+#define isutf(c) (((c) & 0xC0) != 0x80)
+
+extern char *password;
+extern int input_position;
+/* Keys pressed while PAM was verifying (and which were ignored). */
+extern uint64_t auth_keys_pressed;
+extern histogram_t key_handler_time;
+extern histogram_t key_handler_render_time;
+
+void input_init(void (*done)(void), void (*cleared)(void));
+void u8_dec(char *s, int *i);
+void clear_password_memory(void);
+void clear_input(void);
+void handle_key_press_core(struct xkb_state *xkb_state, xkb_keycode_t key, xkb_keysym_t ksym);
+
+#endif
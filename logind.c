@@ -0,0 +1,202 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010-2012 Michael Stapelberg
+ *
+ * logind.c: locks the screen before the system suspends. We hold a delay
+ *           inhibitor of systemd-logind, so logind waits (up to its
+ *           InhibitDelayMaxSec) for us when it announces the suspend with
+ *           PrepareForSleep. The inhibitor is released once the screen is
+ *           locked and taken again after resuming.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <ev.h>
+#include <systemd/sd-bus.h>
+
+#include "i3lock.h"
+#include "logind.h"
+
+extern bool debug_mode;
+extern struct ev_loop *main_loop;
+
+static sd_bus *bus;
+static struct ev_io bus_watcher;
+/* sd-bus has timeouts of its own, e.g. for method calls in flight. */
+static struct ev_timer bus_timer;
+static int inhibitor_fd = -1;
+static void (*before_sleep_cb)(void);
+
+static void take_inhibitor(void) {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_message *reply = NULL;
+    int fd;
+
+    if (inhibitor_fd != -1)
+        return;
+
+    int r = sd_bus_call_method(bus,
+                               "org.freedesktop.login1",
+                               "/org/freedesktop/login1",
+                               "org.freedesktop.login1.Manager",
+                               "Inhibit",
+                               &error,
+                               &reply,
+                               "ssss",
+                               "sleep",
+                               "i3lock",
+                               "Lock the screen before suspending",
+                               "delay");
+    if (r < 0) {
+        fprintf(stderr, "Could not take the logind sleep inhibitor: %s\n",
+                error.message ? error.message : strerror(-r));
+        goto out;
+    }
+
+    /* The file descriptor belongs to the message, so we need our own. */
+    if (sd_bus_message_read(reply, "h", &fd) >= 0)
+        inhibitor_fd = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+    DEBUG("took the logind sleep inhibitor (fd %d)\n", inhibitor_fd);
+
+out:
+    sd_bus_error_free(&error);
+    sd_bus_message_unref(reply);
+}
+
+static void release_inhibitor(void) {
+    if (inhibitor_fd == -1)
+        return;
+
+    close(inhibitor_fd);
+    inhibitor_fd = -1;
+    DEBUG("released the logind sleep inhibitor\n");
+}
+
+/*
+ * Called when logind sends PrepareForSleep: with true before suspending, with
+ * false after resuming.
+ *
+ */
+static int prepare_for_sleep(sd_bus_message *message, void *userdata, sd_bus_error *ret_error) {
+    int start;
+
+    if (sd_bus_message_read(message, "b", &start) < 0)
+        return 0;
+
+    if (start) {
+        before_sleep_cb();
+        release_inhibitor();
+    } else {
+        take_inhibitor();
+    }
+
+    return 0;
+}
+
+/*
+ * Watches for what sd-bus waits for now: the events on its file descriptor
+ * (it needs to write as well while its output queue is not empty) and its
+ * next timeout, an absolute CLOCK_MONOTONIC time in microseconds.
+ *
+ */
+static void update_bus_watchers(void) {
+    const int events = sd_bus_get_events(bus);
+    const int ev_events = (events > 0 && (events & POLLIN) ? EV_READ : 0) |
+                          (events > 0 && (events & POLLOUT) ? EV_WRITE : 0);
+    if (ev_events != (bus_watcher.events & (EV_READ | EV_WRITE))) {
+        ev_io_stop(main_loop, &bus_watcher);
+        ev_io_set(&bus_watcher, sd_bus_get_fd(bus), ev_events);
+        if (ev_events != 0)
+            ev_io_start(main_loop, &bus_watcher);
+    }
+
+    uint64_t until;
+    ev_timer_stop(main_loop, &bus_timer);
+    if (sd_bus_get_timeout(bus, &until) > 0 && until != UINT64_MAX) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        const uint64_t now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        ev_timer_set(&bus_timer, until > now ? (until - now) / 1e6 : 0., 0.);
+        ev_timer_start(main_loop, &bus_timer);
+    }
+}
+
+static void process_bus(void) {
+    while (sd_bus_process(bus, NULL) > 0)
+        ;
+    update_bus_watchers();
+}
+
+static void bus_got_event(EV_P_ struct ev_io *w, int revents) {
+    process_bus();
+}
+
+static void bus_timeout_cb(EV_P_ ev_timer *w, int revents) {
+    process_bus();
+}
+
+/*
+ * Flush before blocking (and waiting for new events)
+ *
+ */
+static void bus_prepare_cb(EV_P_ ev_prepare *w, int revents) {
+    sd_bus_flush(bus);
+    update_bus_watchers();
+}
+
+/*
+ * Connects to the system bus and takes the sleep inhibitor. before_sleep is
+ * called when the system is about to suspend, it has to return only once the
+ * screen is locked. Returns false if logind is not available.
+ *
+ */
+bool logind_init(void (*before_sleep)(void)) {
+    int r;
+
+    before_sleep_cb = before_sleep;
+
+    /* sd-bus honors $DBUS_SYSTEM_BUS_ADDRESS, so a stub logind on a private
+     * bus can be used for testing. */
+    if ((r = sd_bus_open_system(&bus)) < 0) {
+        fprintf(stderr, "Could not connect to the system bus: %s\n", strerror(-r));
+        return false;
+    }
+
+    r = sd_bus_match_signal(bus,
+                            NULL,
+                            "org.freedesktop.login1",
+                            "/org/freedesktop/login1",
+                            "org.freedesktop.login1.Manager",
+                            "PrepareForSleep",
+                            prepare_for_sleep,
+                            NULL);
+    if (r < 0) {
+        fprintf(stderr, "Could not subscribe to PrepareForSleep: %s\n", strerror(-r));
+        bus = sd_bus_unref(bus);
+        return false;
+    }
+
+    take_inhibitor();
+
+    struct ev_prepare *bus_prepare = calloc(sizeof(struct ev_prepare), 1);
+
+    ev_io_init(&bus_watcher, bus_got_event, sd_bus_get_fd(bus), 0);
+    ev_timer_init(&bus_timer, bus_timeout_cb, 0., 0.);
+
+    ev_prepare_init(bus_prepare, bus_prepare_cb);
+    ev_prepare_start(main_loop, bus_prepare);
+
+    /* Process whatever arrived while we were setting up, this starts the
+     * watchers as well. */
+    process_bus();
+
+    return true;
+}
@@ -0,0 +1,8 @@
+#ifndef _LOGIND_H
+#define _LOGIND_H
+
+#include <stdbool.h>
+
+bool logind_init(void (*before_sleep)(void));
+
+#endif
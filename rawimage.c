@@ -0,0 +1,215 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010-2012 Michael Stapelberg
+ *
+ * rawimage.c: loads the background from raw pixel data on an inherited file
+ *             descriptor (--image-fd), so that a screenshot tool does not
+ *             have to encode a PNG just for us to decode it again.
+ *
+ * If the file descriptor refers to a file which can be mapped (a memfd, or a
+ * file on a tmpfs), the mapping is used as the data of the cairo surface
+ * directly, nothing is copied. The mapping is private, so effects (-e) which
+ * modify the image do not modify the file. Otherwise (a pipe), the rows are
+ * read straight into a new image surface.
+ *
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cairo.h>
+
+#include "i3lock.h"
+#include "rawimage.h"
+#include "stats.h"
+
+extern bool debug_mode;
+
+struct mapping {
+    void *addr;
+    size_t length;
+};
+
+static const cairo_user_data_key_t mapping_key;
+
+static void unmap(void *data) {
+    struct mapping *mapping = data;
+    munmap(mapping->addr, mapping->length);
+    free(mapping);
+}
+
+/*
+ * Reads exactly count bytes (or up to the end of the file, which is treated
+ * as an error). Returns false if not all of them could be read.
+ *
+ */
+static bool read_full(int fd, void *buf, size_t count) {
+    while (count > 0) {
+        ssize_t n = read(fd, buf, count);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buf = (char *)buf + n;
+        count -= n;
+    }
+    return true;
+}
+
+/*
+ * Checks the header and returns the cairo format of the image, or
+ * CAIRO_FORMAT_INVALID (after printing the problem).
+ *
+ */
+static cairo_format_t check_header(const raw_image_header_t *header) {
+    cairo_format_t format;
+    if (header->format == RAW_FORMAT_ARGB32)
+        format = CAIRO_FORMAT_ARGB32;
+    else if (header->format == RAW_FORMAT_RGB24)
+        format = CAIRO_FORMAT_RGB24;
+    else {
+        fprintf(stderr, "Could not load raw image: unsupported format %u\n", header->format);
+        return CAIRO_FORMAT_INVALID;
+    }
+
+    /* cairo’s limit for image surfaces. */
+    if (header->width == 0 || header->height == 0 ||
+        header->width > 32767 || header->height > 32767) {
+        fprintf(stderr, "Could not load raw image: invalid size %ux%u\n",
+                header->width, header->height);
+        return CAIRO_FORMAT_INVALID;
+    }
+
+    if (header->stride % 4 != 0 ||
+        header->stride < (uint32_t)cairo_format_stride_for_width(format, header->width)) {
+        fprintf(stderr, "Could not load raw image: invalid stride %u for width %u\n",
+                header->stride, header->width);
+        return CAIRO_FORMAT_INVALID;
+    }
+
+    return format;
+}
+
+/*
+ * Uses the mapping of the whole file as the image data, which follows right
+ * after the header. The file must be long enough. Returns NULL if it cannot
+ * be mapped.
+ *
+ */
+static cairo_surface_t *map_image(int fd, const raw_image_header_t *header, cairo_format_t format) {
+    const size_t length = sizeof(raw_image_header_t) + (size_t)header->height * header->stride;
+
+    struct mapping *mapping = malloc(sizeof(struct mapping));
+    if (mapping == NULL)
+        return NULL;
+    mapping->length = length;
+    mapping->addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (mapping->addr == MAP_FAILED) {
+        free(mapping);
+        return NULL;
+    }
+
+    cairo_surface_t *surface = cairo_image_surface_create_for_data(
+        (unsigned char *)mapping->addr + sizeof(raw_image_header_t),
+        format, header->width, header->height, header->stride);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS ||
+        cairo_surface_set_user_data(surface, &mapping_key, mapping, unmap) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(surface);
+        unmap(mapping);
+        return NULL;
+    }
+
+    return surface;
+}
+
+/*
+ * Reads the image data row by row into a new image surface, skipping the
+ * padding at the end of each row.
+ *
+ */
+static cairo_surface_t *read_image(int fd, const raw_image_header_t *header, cairo_format_t format) {
+    cairo_surface_t *surface = cairo_image_surface_create(format, header->width, header->height);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(surface);
+        return NULL;
+    }
+
+    cairo_surface_flush(surface);
+    unsigned char *data = cairo_image_surface_get_data(surface);
+    const int stride = cairo_image_surface_get_stride(surface);
+    const size_t row = (size_t)header->width * 4;
+    const size_t padding = header->stride - row;
+    char skip[256];
+
+    for (uint32_t y = 0; y < header->height; y++) {
+        bool ok = read_full(fd, data + (size_t)y * stride, row);
+        for (size_t left = padding; ok && left > 0;) {
+            const size_t n = (left < sizeof(skip) ? left : sizeof(skip));
+            ok = read_full(fd, skip, n);
+            left -= n;
+        }
+        if (!ok) {
+            fprintf(stderr, "Could not load raw image: short read in row %u\n", y);
+            cairo_surface_destroy(surface);
+            return NULL;
+        }
+    }
+
+    cairo_surface_mark_dirty(surface);
+    return surface;
+}
+
+/*
+ * Loads a raw image (see rawimage.h) from the given file descriptor and closes
+ * it. Returns NULL (after printing the problem) if the image is invalid.
+ *
+ */
+cairo_surface_t *load_raw_image(int fd) {
+    const uint64_t start = now_ns();
+    cairo_surface_t *surface = NULL;
+    raw_image_header_t header;
+    struct stat st;
+
+    /* A memfd is usually handed over right after writing it, i.e. without
+     * seeking back to its beginning. */
+    const bool regular = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode));
+    if (regular)
+        lseek(fd, 0, SEEK_SET);
+
+    if (!read_full(fd, &header, sizeof(header))) {
+        fprintf(stderr, "Could not load raw image: cannot read the header\n");
+        goto out;
+    }
+
+    cairo_format_t format = check_header(&header);
+    if (format == CAIRO_FORMAT_INVALID)
+        goto out;
+
+    /* A regular file (a memfd) is mapped as a whole, including the header. If
+     * it cannot be mapped, it is read like a pipe. */
+    if (regular) {
+        if ((size_t)st.st_size < sizeof(header) + (size_t)header.height * header.stride) {
+            fprintf(stderr, "Could not load raw image: the file is too short for %ux%u pixels\n",
+                    header.width, header.height);
+            goto out;
+        }
+        if ((surface = map_image(fd, &header, format)) != NULL) {
+            DEBUG("mapped %ux%u raw image in %.1f ms\n",
+                  header.width, header.height, (now_ns() - start) / 1e6);
+            goto out;
+        }
+    }
+
+    if ((surface = read_image(fd, &header, format)) != NULL)
+        DEBUG("read %ux%u raw image in %.1f ms\n",
+              header.width, header.height, (now_ns() - start) / 1e6);
+
+out:
+    close(fd);
+    return surface;
+}
@@ -0,0 +1,24 @@
+#ifndef _RAWIMAGE_H
+#define _RAWIMAGE_H
+
+#include <stdint.h>
+#include <cairo.h>
+
+/* The header of a raw image (--image-fd). It is followed by height rows of
+ * stride bytes each. All fields are in native byte order. */
+typedef struct raw_image_header {
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    /* RAW_FORMAT_*, the same values as the corresponding cairo_format_t. */
+    uint32_t format;
+} raw_image_header_t;
+
+/* 32 bit per pixel, native endian, alpha in the upper 8 bits, premultiplied. */
+#define RAW_FORMAT_ARGB32 0
+/* Like RAW_FORMAT_ARGB32, but the upper 8 bits are unused. */
+#define RAW_FORMAT_RGB24 1
+
+cairo_surface_t *load_raw_image(int fd);
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010-2012 Michael Stapelberg
+ *
+ * secure.c: memory for secrets: the password and the copies of it which are
+ *           handed to PAM as conversation responses. They live in a small
+ *           arena which is mapped separately from the heap, locked into RAM
+ *           (so it is never written to swap) and excluded from core dumps.
+ *           The arena consists of a few slots of the same size, a slot is
+ *           wiped when it is freed.
+ *
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#if !defined(__GLIBC__)
+#include <dlfcn.h>
+#endif
+
+#include "secure.h"
+
+/* The password and the responses to a few prompts at once (e.g. password
+ * and one time token), PAM frees the responses after each attempt. */
+#define SLOTS 8
+
+static uint8_t *arena;
+static size_t arena_size;
+static size_t slot_size;
+static bool slot_used[SLOTS];
+/* The responses are allocated and freed in the authentication thread. */
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Overwrites the given memory with zeros in a way the compiler cannot optimize
+ * away, even though the memory is not read afterwards.
+ *
+ */
+void secure_wipe(void *ptr, size_t size) {
+    volatile uint8_t *p = ptr;
+    while (size--)
+        *p++ = 0;
+}
+
+/*
+ * Maps the arena, with slots of the given size, and locks it. It is never
+ * unmapped, the password lives as long as i3lock does. Returns false (with
+ * errno set) if the memory cannot be locked.
+ *
+ */
+bool secure_arena_init(size_t size) {
+    /* Every slot starts at a multiple of 16 bytes, like malloc() memory. */
+    slot_size = (size + 15) & ~(size_t)15;
+    arena_size = slot_size * SLOTS;
+    void *memory = mmap(NULL, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return false;
+
+/* Using mlock() as non-super-user seems only possible in Linux. Users of other
+ * operating systems should use encrypted swap/no swap (or remove the ifdef and
+ * run i3lock as super-user). */
+#if defined(__linux__)
+    /* Since Linux 2.6.9, this does not require any privileges, just enough
+     * bytes in the RLIMIT_MEMLOCK limit. */
+    if (mlock(memory, arena_size) != 0) {
+        /* The caller reports why mlock() failed. */
+        int error = errno;
+        munmap(memory, arena_size);
+        errno = error;
+        return false;
+    }
+#endif
+#ifdef MADV_DONTDUMP
+    madvise(memory, arena_size, MADV_DONTDUMP);
+#endif
+
+    arena = memory;
+    return true;
+}
+
+static bool in_arena(const void *ptr) {
+    return (arena != NULL && (const uint8_t *)ptr >= arena && (const uint8_t *)ptr < arena + arena_size);
+}
+
+/*
+ * Returns a zeroed slot of the arena, or NULL if size is larger than a slot
+ * or all slots are in use.
+ *
+ */
+void *secure_alloc(size_t size) {
+    void *ptr = NULL;
+
+    if (arena == NULL || size > slot_size)
+        return NULL;
+
+    pthread_mutex_lock(&arena_lock);
+    for (int i = 0; i < SLOTS; i++) {
+        if (!slot_used[i]) {
+            slot_used[i] = true;
+            ptr = arena + i * slot_size;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&arena_lock);
+
+    return ptr;
+}
+
+/*
+ * Wipes the slot and returns it to the arena.
+ *
+ */
+void secure_free(void *ptr) {
+    if (!in_arena(ptr))
+        return;
+
+    const size_t slot = ((uint8_t *)ptr - arena) / slot_size;
+    secure_wipe(arena + slot * slot_size, slot_size);
+    pthread_mutex_lock(&arena_lock);
+    slot_used[slot] = false;
+    pthread_mutex_unlock(&arena_lock);
+}
+
+/*
+ * Returns a copy of the given string in the arena, for the responses of the
+ * PAM conversation. Returns NULL if it does not fit or the arena is full.
+ *
+ */
+char *secure_strdup(const char *str) {
+    const size_t length = strlen(str);
+    char *copy = secure_alloc(length + 1);
+    if (copy != NULL)
+        memcpy(copy, str, length + 1);
+    return copy;
+}
+
+/*
+ * PAM frees the responses of the conversation with free(). So that they can
+ * live in the arena (and are wiped when freed), free() is wrapped: memory of
+ * the arena goes back to the arena, everything else to the C library.
+ *
+ */
+#if defined(__GLIBC__)
+extern void __libc_free(void *ptr);
+#define libc_free __libc_free
+#else
+static void libc_free(void *ptr) {
+    static void (*next_free)(void *);
+    if (next_free == NULL)
+        next_free = (void (*)(void *))dlsym(RTLD_NEXT, "free");
+    next_free(ptr);
+}
+#endif
+
+void free(void *ptr) {
+    if (in_arena(ptr))
+        secure_free(ptr);
+    else
+        libc_free(ptr);
+}
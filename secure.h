@@ -0,0 +1,13 @@
+#ifndef _SECURE_H
+#define _SECURE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+bool secure_arena_init(size_t size);
+void *secure_alloc(size_t size);
+void secure_free(void *ptr);
+char *secure_strdup(const char *str);
+void secure_wipe(void *ptr, size_t size);
+
+#endif
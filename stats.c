@@ -0,0 +1,145 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010-2012 Michael Stapelberg
+ *
+ * stats.c: fixed-size histograms for the measurements which are printed in
+ *          debug mode (render times, latencies, …). Adding a value never
+ *          allocates memory, so this can be used on every frame.
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+/*
+ * Returns the current time of the monotonic clock in nanoseconds.
+ *
+ */
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Returns the resident set size of this process in KiB, or -1 if it cannot be
+ * determined.
+ *
+ */
+long resident_memory_kib(void) {
+    long pages;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL)
+        return -1;
+
+    if (fscanf(statm, "%*s %ld", &pages) != 1)
+        pages = -1;
+    fclose(statm);
+
+    if (pages < 0)
+        return -1;
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int bucket_for(uint64_t value) {
+    if (value < (1 << HISTOGRAM_SUB_BITS))
+        return value;
+
+    int log2 = 63 - __builtin_clzll(value);
+    int shift = log2 - HISTOGRAM_SUB_BITS;
+    int sub = (value >> shift) & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    return ((shift + 1) << HISTOGRAM_SUB_BITS) + sub;
+}
+
+/* Returns the largest value which falls into the given bucket. */
+static uint64_t bucket_max(int bucket) {
+    if (bucket < (1 << HISTOGRAM_SUB_BITS))
+        return bucket;
+
+    int shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+    uint64_t sub = bucket & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    return (((1ULL << HISTOGRAM_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+void histogram_add(histogram_t *h, uint64_t value) {
+    if (h->count == 0 || value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+    h->count++;
+    h->sum += value;
+    h->buckets[bucket_for(value)]++;
+}
+
+/*
+ * Returns an upper bound for the given percentile (0-100) of all values added
+ * so far.
+ *
+ */
+uint64_t histogram_percentile(histogram_t *h, double percentile) {
+    uint64_t wanted = (uint64_t)(h->count * (percentile / 100.0) + 0.5);
+    uint64_t seen = 0;
+
+    if (wanted == 0)
+        wanted = 1;
+
+    for (int c = 0; c < HISTOGRAM_BUCKETS; c++) {
+        seen += h->buckets[c];
+        if (seen >= wanted)
+            return (bucket_max(c) < h->max ? bucket_max(c) : h->max);
+    }
+
+    return h->max;
+}
+
+/*
+ * Removes all values, but keeps the name.
+ *
+ */
+void histogram_reset(histogram_t *h) {
+    const char *name = h->name;
+    memset(h, 0, sizeof(*h));
+    h->name = name;
+}
+
+void histogram_print(histogram_t *h) {
+    if (h->count == 0) {
+        printf("[i3lock-debug] %s: no samples\n", h->name);
+        return;
+    }
+
+    printf("[i3lock-debug] %s: n=%llu avg=%llu min=%llu p50=%llu p90=%llu p99=%llu max=%llu\n",
+           h->name,
+           (unsigned long long)h->count,
+           (unsigned long long)(h->sum / h->count),
+           (unsigned long long)h->min,
+           (unsigned long long)histogram_percentile(h, 50),
+           (unsigned long long)histogram_percentile(h, 90),
+           (unsigned long long)histogram_percentile(h, 99),
+           (unsigned long long)h->max);
+}
+
+/*
+ * Prints one row of the table the benchmarks (bench/) print, labeled with the
+ * given unit instead of the name.
+ *
+ */
+void histogram_print_row(const char *label, histogram_t *h) {
+    if (h->count == 0) {
+        printf("  %-26s no samples\n", label);
+        return;
+    }
+
+    printf("  %-26s avg %10llu  p50 %10llu  p90 %10llu  p99 %10llu  max %10llu\n",
+           label,
+           (unsigned long long)(h->sum / h->count),
+           (unsigned long long)histogram_percentile(h, 50),
+           (unsigned long long)histogram_percentile(h, 90),
+           (unsigned long long)histogram_percentile(h, 99),
+           (unsigned long long)h->max);
+}
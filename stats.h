@@ -0,0 +1,28 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+
+/* Every power of two is split into 2^HISTOGRAM_SUB_BITS buckets, so the
+ * percentiles we report are accurate to about 12.5%. */
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_BUCKETS (64 << HISTOGRAM_SUB_BITS)
+
+typedef struct histogram {
+    const char *name;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+uint64_t now_ns(void);
+long resident_memory_kib(void);
+void histogram_add(histogram_t *h, uint64_t value);
+uint64_t histogram_percentile(histogram_t *h, double percentile);
+void histogram_reset(histogram_t *h);
+void histogram_print(histogram_t *h);
+void histogram_print_row(const char *label, histogram_t *h);
+
+#endif
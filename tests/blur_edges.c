@@ -0,0 +1,65 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010-2012 Michael Stapelberg
+ *
+ * blur_edges.c: checks that scaling a blurred image back up clamps at the
+ *               bottom edge, on images which are only a few rows tall. The
+ *               functions are static, so blur.c is included as it is.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../blur.c"
+
+/*
+ * Scales a 2 pixel wide image with the given rows (each a single gray value)
+ * up by factor and checks that every column goes from the first to the last
+ * value without ever going back, and that the rows at the bottom edge have
+ * exactly the value of the last row.
+ *
+ */
+static bool check(const uint8_t *values, int rows, int factor) {
+    const int width = 2, dst_width = width * factor, dst_height = rows * factor;
+    uint8_t *src = malloc(width * 4 * rows);
+    uint8_t *dst = malloc(dst_width * 4 * dst_height);
+    for (int y = 0; y < rows; y++)
+        memset(src + y * width * 4, values[y], width * 4);
+
+    struct blur_job job = {
+        .src = src, .src_width = width, .src_height = rows, .src_stride = width * 4,
+        .dst = dst, .dst_width = dst_width, .dst_height = dst_height, .dst_stride = dst_width * 4,
+        .factor = factor, .first_row = 0, .last_row = dst_height,
+    };
+    scale_up_rows(&job);
+
+    bool ok = true;
+    for (int y = 0; y < dst_height; y++) {
+        const uint8_t value = dst[y * dst_width * 4];
+        const uint8_t above = (y > 0 ? dst[(y - 1) * dst_width * 4] : values[0]);
+        const bool edge = (scaled_position(y, factor) >> 8 >= rows - 1);
+        if (value < above || (edge && value != values[rows - 1])) {
+            fprintf(stderr, "%d rows, factor %d: row %d is %d (row above: %d, last row: %d)\n",
+                    rows, factor, y, value, above, values[rows - 1]);
+            ok = false;
+        }
+    }
+
+    free(src);
+    free(dst);
+    return ok;
+}
+
+int main(void) {
+    static const uint8_t values[] = { 0, 100, 200, 250 };
+    bool ok = true;
+
+    for (int rows = 1; rows <= 4; rows++)
+        for (int factor = 1; factor <= 8; factor++)
+            ok &= check(values + 4 - rows, rows, factor);
+
+    printf("blur_edges: %s\n", ok ? "ok" : "FAILED");
+    return (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
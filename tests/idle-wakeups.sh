@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+# Checks that i3lock stays blocked in the kernel while the screen is locked
+# and nobody types: it locks the screen of an Xvfb, waits for things to
+# settle and then counts, over IDLE_SECONDS (default 10),
+#
+# - the context switches of all its threads (each wakeup is at least one),
+# - with strace, the system calls it makes.
+#
+# libev wakes up about once a minute to detect clock jumps, which is what
+# the default limits (MAX_WAKEUPS=2, MAX_SYSCALLS=4) leave room for.
+#
+cd "$(dirname "$0")/.." || exit 1
+. tests/xvfb.sh
+
+idle=${IDLE_SECONDS:-10}
+max_wakeups=${MAX_WAKEUPS:-2}
+max_syscalls=${MAX_SYSCALLS:-4}
+
+[ -x ./i3lock ] || fail "i3lock is not built"
+[ -d /proc/self/task ] || skip "no /proc"
+start_xvfb -screen 0 1280x800x24
+
+context_switches() {
+    cat /proc/"$1"/task/*/status 2>/dev/null |
+        awk '/ctxt_switches/ { n += $2 } END { print n + 0 }'
+}
+
+# The wakeups are counted without strace, which adds context switches of
+# its own for every system call.
+./i3lock -n --ready-fd=3 3>"$tmp/ready" &
+pid=$!
+wait_for_file "$tmp/ready" || fail "i3lock did not lock the screen"
+sleep 1
+before=$(context_switches $pid)
+sleep "$idle"
+after=$(context_switches $pid)
+kill $pid
+wait $pid 2>/dev/null
+wakeups=$((after - before))
+echo "context switches in ${idle}s while locked: $wakeups (at most $max_wakeups)"
+
+syscalls=0
+if ! command -v strace >/dev/null 2>&1; then
+    echo "strace not found, not counting system calls"
+else
+    rm -f "$tmp/ready"
+    strace -f -ttt -o "$tmp/strace" ./i3lock -n --ready-fd=3 3>"$tmp/ready" &
+    strace_pid=$!
+    if ! wait_for_file "$tmp/ready"; then
+        kill $strace_pid 2>/dev/null
+        skip "strace cannot trace i3lock here"
+    fi
+    sleep 1
+    start=$(date +%s.%N)
+    sleep "$idle"
+    end=$(date +%s.%N)
+    pkill -P $strace_pid
+    wait $strace_pid 2>/dev/null
+
+    # Every line is "pid timestamp syscall(...)". A system call which blocks
+    # while another thread makes one is continued on a "resumed" line, which
+    # is not a system call of its own, neither are signals and exits.
+    awk -v start="$start" -v end="$end" \
+        '$2 >= start && $2 < end && !/resumed>/ && $3 != "---" && $3 != "+++"' \
+        "$tmp/strace" >"$tmp/idle-syscalls"
+    syscalls=$(wc -l <"$tmp/idle-syscalls")
+    echo "system calls in ${idle}s while locked: $syscalls (at most $max_syscalls)"
+    [ "$syscalls" -le "$max_syscalls" ] || head -n 20 "$tmp/idle-syscalls"
+fi
+
+[ "$wakeups" -le "$max_wakeups" ] || fail "$wakeups context switches while idle"
+[ "$syscalls" -le "$max_syscalls" ] || fail "$syscalls system calls while idle"
+echo "idle-wakeups: ok"
@@ -0,0 +1,83 @@
+#!/bin/sh
+#
+# Suspends (as far as i3lock can tell) while i3lock --daemon, built with
+# WITH_LOGIND=1, runs against a stand-in for logind (stub-logind.py) on a
+# private bus started with dbus-daemon --session. When PrepareForSleep(true)
+# is sent, the keyboard is grabbed by tests/xtest -H for HOLD_MS (300), so
+# i3lock can lock the screen only once that grab is gone. Fails if
+#
+# - i3lock does not take the delay inhibitor when starting,
+# - it releases the inhibitor before the keyboard was let go of, i.e. before
+#   the screen can have been locked,
+# - the screen is not locked (the keyboard is not grabbed) once the
+#   inhibitor is released,
+# - it does not take the inhibitor again after PrepareForSleep(false).
+#
+cd "$(dirname "$0")/.." || exit 1
+. tests/xvfb.sh
+
+hold=${HOLD_MS:-300}
+
+[ -x ./i3lock ] || fail "i3lock is not built"
+[ -x tests/xtest ] || skip "tests/xtest is not built (it needs xcb-xtest and xcb-damage)"
+grep -qa "logind sleep inhibitor" ./i3lock || skip "i3lock is built without WITH_LOGIND"
+require dbus-daemon python3
+python3 -c 'from gi.repository import Gio' 2>/dev/null || skip "python3-gi not found"
+
+bus_pid=
+stub_pid=
+i3lock_pid=
+trap 'kill $i3lock_pid $stub_pid $bus_pid 2>/dev/null; cleanup' EXIT
+
+# Waits up to 5 seconds until the stub printed the given event n times.
+wait_for_stub() {
+    i=0
+    while [ "$(grep -c "^$1 .*at" "$tmp/logind")" -lt "$2" ]; do
+        i=$((i + 1))
+        [ $i -le 500 ] || return 1
+        sleep 0.01
+    done
+}
+
+# The time (in microseconds) of the last line starting with the given text.
+time_of() {
+    awk -v what="$1" 'index($0, what) == 1 { t = $NF } END { print t }' "$2"
+}
+
+dbus-daemon --session --nofork --print-address=5 5>"$tmp/bus" &
+bus_pid=$!
+wait_for_file "$tmp/bus" || fail "dbus-daemon did not start"
+DBUS_SYSTEM_BUS_ADDRESS=$(cat "$tmp/bus")
+export DBUS_SYSTEM_BUS_ADDRESS
+
+python3 tests/stub-logind.py >"$tmp/logind" &
+stub_pid=$!
+wait_for_file "$tmp/logind" || fail "stub-logind.py did not start"
+
+start_xvfb -screen 0 1280x800x24
+
+# The control socket goes to $tmp, so that a daemon which is running
+# already is not in the way.
+XDG_RUNTIME_DIR=$tmp ./i3lock --daemon --debug --ready-fd=3 3>"$tmp/ready" 2>"$tmp/i3lock.log" &
+i3lock_pid=$!
+wait_for_file "$tmp/ready" || fail "the daemon did not start: $(cat "$tmp/i3lock.log")"
+wait_for_stub "inhibitor taken" 1 || fail "i3lock did not take the sleep inhibitor"
+
+tests/xtest -H "$hold" >"$tmp/hold" &
+hold_pid=$!
+wait_for_file "$tmp/hold" || fail "tests/xtest did not grab the keyboard"
+kill -USR1 $stub_pid
+wait $hold_pid || fail "could not hold the keyboard: $(cat "$tmp/hold")"
+wait_for_stub "inhibitor released" 1 || fail "i3lock did not release the sleep inhibitor"
+
+let_go=$(time_of "released the keyboard" "$tmp/hold")
+released=$(time_of "inhibitor released" "$tmp/logind")
+echo "inhibitor released $(((released - let_go) / 1000)) ms after the keyboard was free to grab"
+[ "$released" -gt "$let_go" ] || fail "the inhibitor was released before the screen was locked"
+tests/xtest -H 0 >/dev/null
+[ $? -eq 1 ] || fail "the screen is not locked after releasing the inhibitor"
+
+kill -USR2 $stub_pid
+wait_for_stub "inhibitor taken" 2 || fail "i3lock did not take the sleep inhibitor again after resuming"
+
+echo "logind-sleep: ok"
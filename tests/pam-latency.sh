@@ -0,0 +1,84 @@
+#!/bin/sh
+#
+# Runs the PAM code path of i3lock against a stand-in for a slow or flaky
+# authentication backend: a service file (pam-service.in) with the stub
+# module tests/pam_i3lock_test.so. The screen of an Xvfb is locked with
+# i3lock -n --debug --pam-service=..., the password is typed through XTEST
+# (tests/xtest) and, when unlocking, i3lock prints how long verifying took,
+# how many frames it drew and keys it got meanwhile, and the time from Return
+# to unlocking. Fails if
+#
+# - with a backend taking DELAY_MS (1000) to answer, unlocking takes more
+#   than MAX_OVERHEAD_MS (300) longer than that, or the screen stands still
+#   for more than MAX_GAP_MS (100) while keys are pressed during verifying,
+# - a password and a token prompt (and an info message) are not answered,
+# - with FAIL_PERCENT (50) of the attempts rejected, 20 attempts do not
+#   unlock,
+# - the response to the prompt is not in locked memory excluded from core
+#   dumps, or a copy of the password is found on the heap (secret= of the
+#   module).
+#
+# The service file is read through pam_wrapper (PAM_WRAPPER_LIB, or found
+# with ldconfig) or, when running as root, installed in /etc/pam.d for the
+# duration of the test.
+#
+cd "$(dirname "$0")/.." || exit 1
+. tests/xvfb.sh
+
+[ -x ./i3lock ] || fail "i3lock is not built"
+[ -x tests/xtest ] || skip "tests/xtest is not built (it needs xcb-xtest and xcb-damage)"
+[ -f tests/pam_i3lock_test.so ] || skip "tests/pam_i3lock_test.so is not built (it needs libpam-dev)"
+
+delay=${DELAY_MS:-1000}
+overhead=${MAX_OVERHEAD_MS:-300}
+module=$(pwd)/tests/pam_i3lock_test.so
+service=i3lock-test-$$
+
+pam_wrapper=${PAM_WRAPPER_LIB:-$(ldconfig -p 2>/dev/null | awk '/libpam_wrapper\.so/ { print $NF; exit }')}
+if [ -n "$pam_wrapper" ]; then
+    service_dir=$tmp/pam.d
+    mkdir "$service_dir"
+    pam_env="env LD_PRELOAD=$pam_wrapper PAM_WRAPPER=1 PAM_WRAPPER_SERVICE_DIR=$service_dir"
+elif [ -w /etc/pam.d ]; then
+    service_dir=/etc/pam.d
+    pam_env=
+    trap 'rm -f "/etc/pam.d/$service"; cleanup' EXIT
+else
+    skip "neither pam_wrapper nor a writable /etc/pam.d"
+fi
+
+# Writes the service file, with the given arguments for the module.
+configure() {
+    sed -e "s|@MODULE@|$module|" -e "s|@ARGS@|$*|" tests/pam-service.in >"$service_dir/$service"
+}
+
+# Locks the screen and types $password, the arguments after the name of the
+# scenario are passed to tests/xtest.
+password=secret
+unlock() {
+    name=$1
+    shift
+    echo "$name:"
+    tests/xtest -k 5 -p "$password" "$@" -- $pam_env ./i3lock -n --debug --pam-service="$service" ||
+        fail "$name, see above"
+}
+
+start_xvfb -screen 0 1920x1080x24
+
+configure delay="$delay"
+unlock "slow backend ($delay ms)" -a 5 -S "${MAX_GAP_MS:-100}" -U $((delay + overhead))
+
+configure delay=200 prompts=2 info
+unlock "password and token" -U $((200 + overhead))
+
+# The backend answers after 200 ms, so an attempt which did not unlock
+# within 1 s was rejected and is typed again.
+configure delay=200 fail="${FAIL_PERCENT:-50}"
+unlock "flaky backend (${FAIL_PERCENT:-50}% rejected)" -A 20 -W 1000
+
+# A password which does not appear anywhere else in memory by chance.
+password=k3ep-0ff-h3ap
+configure secret="$(printf %s "$password" | od -An -tx1 | tr -d ' \n')"
+unlock "password kept off the heap"
+
+echo "pam-latency: ok"
@@ -0,0 +1,183 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010-2012 Michael Stapelberg
+ *
+ * pam_i3lock_test.c: a PAM module which stands in for a slow or flaky
+ *                    authentication backend (e.g. LDAP) in pam-latency.sh.
+ *                    It takes these arguments in the service file:
+ *
+ *                    password=  the password it accepts (default: secret)
+ *                    delay=     milliseconds to wait before answering
+ *                    fail=      percentage of attempts which are rejected
+ *                               even with the right password
+ *                    prompts=   number of prompts (like password and one
+ *                               time token), each a conversation of its own
+ *                    info       send a PAM_TEXT_INFO message before the
+ *                               first prompt
+ *                    secret=    the password it accepts, hex-encoded (so
+ *                               that it is not on the heap in plain text
+ *                               itself), and check that the screen locker
+ *                               keeps it off the heap: the response has to
+ *                               be in locked memory which is excluded from
+ *                               core dumps, and no other copy may be in the
+ *                               heap or in anonymous mappings (where malloc()
+ *                               puts large blocks and the arenas of threads)
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <security/pam_modules.h>
+#include <security/pam_appl.h>
+
+static int converse(pam_handle_t *pamh, int style, const char *text, char **response) {
+    const struct pam_conv *conv;
+    struct pam_message message = { style, text };
+    const struct pam_message *messages = &message;
+    struct pam_response *reply = NULL;
+
+    if (pam_get_item(pamh, PAM_CONV, (const void **)&conv) != PAM_SUCCESS || conv == NULL)
+        return PAM_CONV_ERR;
+
+    int ret = conv->conv(1, &messages, &reply, conv->appdata_ptr);
+    if (ret != PAM_SUCCESS)
+        return PAM_CONV_ERR;
+
+    if (response != NULL)
+        *response = (reply != NULL ? reply->resp : NULL);
+    else if (reply != NULL)
+        free(reply->resp);
+    free(reply);
+    return PAM_SUCCESS;
+}
+
+/*
+ * Decodes the hex-encoded string into buffer (of the given size), returns the
+ * length or -1.
+ *
+ */
+static int decode_hex(const char *hex, char *buffer, size_t size) {
+    size_t length = 0;
+    unsigned int byte;
+
+    while (hex[0] != '\0' && hex[1] != '\0' && length + 1 < size) {
+        if (sscanf(hex, "%2x", &byte) != 1)
+            return -1;
+        buffer[length++] = byte;
+        hex += 2;
+    }
+    buffer[length] = '\0';
+    return (hex[0] == '\0' ? (int)length : -1);
+}
+
+/*
+ * Checks where the secret is in memory, see secret= above. Reads
+ * /proc/self/smaps: each mapping starts with a line "start-end perms offset
+ * device inode [path]" and ends with the line "VmFlags: ...".
+ *
+ */
+static bool secret_kept_safe(const char *response, const char *secret) {
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+    if (smaps == NULL) {
+        fprintf(stderr, "pam_i3lock_test: cannot read /proc/self/smaps\n");
+        return false;
+    }
+
+    char line[512], perms[8], path[256];
+    unsigned long start = 0, end = 0;
+    const uintptr_t stack = (uintptr_t)line;
+    bool response_locked = false, copy_found = false;
+
+    while (fgets(line, sizeof(line), smaps) != NULL) {
+        unsigned long s, e;
+        path[0] = '\0';
+        if (sscanf(line, "%lx-%lx %7s %*s %*s %*s %255s", &s, &e, perms, path) >= 3) {
+            start = s;
+            end = e;
+            continue;
+        }
+        if (strncmp(line, "VmFlags:", strlen("VmFlags:")) != 0)
+            continue;
+
+        if ((uintptr_t)response >= start && (uintptr_t)response < end) {
+            response_locked = (strstr(line, " lo") != NULL && strstr(line, " dd") != NULL);
+            continue;
+        }
+        /* Our own stack holds the decoded secret. */
+        if (perms[0] != 'r' || (stack >= start && stack < end) ||
+            (path[0] != '\0' && strcmp(path, "[heap]") != 0))
+            continue;
+        if (memmem((const void *)start, end - start, secret, strlen(secret)) != NULL) {
+            fprintf(stderr, "pam_i3lock_test: a copy of the password is in %lx-%lx %s\n",
+                    start, end, path[0] != '\0' ? path : "(anonymous)");
+            copy_found = true;
+        }
+    }
+    fclose(smaps);
+
+    if (!response_locked)
+        fprintf(stderr, "pam_i3lock_test: the response is not in locked memory excluded from core dumps\n");
+    return (response_locked && !copy_found);
+}
+
+PAM_EXTERN int pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc, const char **argv) {
+    const char *password = "secret";
+    char secret[256];
+    int delay = 0, fail = 0, prompts = 1;
+    bool info = false, check = false;
+
+    for (int i = 0; i < argc; i++) {
+        if (strncmp(argv[i], "password=", strlen("password=")) == 0)
+            password = argv[i] + strlen("password=");
+        else if (strncmp(argv[i], "secret=", strlen("secret=")) == 0) {
+            if (decode_hex(argv[i] + strlen("secret="), secret, sizeof(secret)) == -1)
+                return PAM_SERVICE_ERR;
+            password = secret;
+            check = true;
+        }
+        else if (sscanf(argv[i], "delay=%d", &delay) == 1 ||
+                 sscanf(argv[i], "fail=%d", &fail) == 1 ||
+                 sscanf(argv[i], "prompts=%d", &prompts) == 1)
+            continue;
+        else if (strcmp(argv[i], "info") == 0)
+            info = true;
+    }
+
+    if (info)
+        converse(pamh, PAM_TEXT_INFO, "Contacting the (simulated) directory server", NULL);
+
+    bool correct = true;
+    for (int i = 0; i < prompts; i++) {
+        char *response = NULL;
+        int ret = converse(pamh, PAM_PROMPT_ECHO_OFF, i == 0 ? "Password: " : "Token: ", &response);
+        if (ret != PAM_SUCCESS)
+            return ret;
+        correct &= (response != NULL && strcmp(response, password) == 0);
+        if (check && response != NULL && !secret_kept_safe(response, password))
+            correct = false;
+        free(response);
+    }
+    memset(secret, 0, sizeof(secret));
+
+    if (delay > 0)
+        usleep(delay * 1000);
+
+    static bool seeded;
+    if (!seeded) {
+        srand(time(NULL) ^ getpid());
+        seeded = true;
+    }
+    if (fail > 0 && rand() % 100 < fail)
+        return PAM_AUTH_ERR;
+
+    return (correct ? PAM_SUCCESS : PAM_AUTH_ERR);
+}
+
+PAM_EXTERN int pam_sm_setcred(pam_handle_t *pamh, int flags, int argc, const char **argv) {
+    return PAM_SUCCESS;
+}
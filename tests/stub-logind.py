@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+#
+# A stand-in for systemd-logind on the bus given in DBUS_SYSTEM_BUS_ADDRESS,
+# for logind-sleep.sh. It implements what i3lock uses of it:
+#
+# - Inhibit, which returns the write end of a pipe. The inhibitor is
+#   released once every copy of it is closed, which the read end tells.
+# - PrepareForSleep, sent with true on SIGUSR1 (the system is about to
+#   suspend) and with false on SIGUSR2 (it resumed).
+#
+# It prints "ready" once it owns org.freedesktop.login1 and a line for every
+# inhibitor taken and released and every signal sent, with the time
+# (CLOCK_MONOTONIC, in microseconds).
+#
+import os
+import signal
+import time
+
+from gi.repository import Gio, GLib
+
+INTROSPECTION = '''
+<node>
+  <interface name="org.freedesktop.login1.Manager">
+    <method name="Inhibit">
+      <arg type="s" name="what" direction="in"/>
+      <arg type="s" name="who" direction="in"/>
+      <arg type="s" name="why" direction="in"/>
+      <arg type="s" name="mode" direction="in"/>
+      <arg type="h" name="fd" direction="out"/>
+    </method>
+    <signal name="PrepareForSleep">
+      <arg type="b" name="start"/>
+    </signal>
+  </interface>
+</node>
+'''
+
+
+def log(what):
+    print('%s at %d' % (what, time.monotonic_ns() // 1000), flush=True)
+
+
+def inhibitor_released(fd, condition):
+    log('inhibitor released')
+    os.close(fd)
+    return GLib.SOURCE_REMOVE
+
+
+def method_call(connection, sender, path, interface, method, args, invocation):
+    what, who, why, mode = args.unpack()
+    if method != 'Inhibit' or what != 'sleep' or mode != 'delay':
+        invocation.return_dbus_error('org.freedesktop.DBus.Error.NotSupported',
+                                     'only delay inhibitors for sleep')
+        return
+
+    read_end, write_end = os.pipe()
+    fds = Gio.UnixFDList.new()
+    # The list has a copy of its own, which is closed once it is sent.
+    index = fds.append(write_end)
+    os.close(write_end)
+    invocation.return_value_with_unix_fd_list(GLib.Variant('(h)', (index,)), fds)
+    GLib.unix_fd_add_full(GLib.PRIORITY_DEFAULT, read_end,
+                          GLib.IOCondition.HUP | GLib.IOCondition.ERR, inhibitor_released)
+    log('inhibitor taken by %s' % who)
+
+
+def prepare_for_sleep(connection, start):
+    log('PrepareForSleep(%s) sent' % ('true' if start else 'false'))
+    connection.emit_signal(None, '/org/freedesktop/login1', 'org.freedesktop.login1.Manager',
+                           'PrepareForSleep', GLib.Variant('(b)', (start,)))
+    return GLib.SOURCE_CONTINUE
+
+
+connection = Gio.bus_get_sync(Gio.BusType.SYSTEM, None)
+node = Gio.DBusNodeInfo.new_for_xml(INTROSPECTION)
+connection.register_object('/org/freedesktop/login1', node.interfaces[0], method_call, None, None)
+
+# 4 is DBUS_NAME_FLAG_DO_NOT_QUEUE, 1 DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER.
+reply = connection.call_sync('org.freedesktop.DBus', '/org/freedesktop/DBus', 'org.freedesktop.DBus',
+                             'RequestName', GLib.Variant('(su)', ('org.freedesktop.login1', 4)),
+                             None, Gio.DBusCallFlags.NONE, -1, None)
+if reply.unpack()[0] != 1:
+    raise SystemExit('stub-logind.py: org.freedesktop.login1 is taken on this bus')
+
+loop = GLib.MainLoop()
+GLib.unix_signal_add(GLib.PRIORITY_DEFAULT, signal.SIGUSR1, prepare_for_sleep, connection, True)
+GLib.unix_signal_add(GLib.PRIORITY_DEFAULT, signal.SIGUSR2, prepare_for_sleep, connection, False)
+GLib.unix_signal_add(GLib.PRIORITY_DEFAULT, signal.SIGTERM, lambda: loop.quit() or GLib.SOURCE_REMOVE)
+
+print('ready', flush=True)
+loop.run()
@@ -0,0 +1,571 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010-2012 Michael Stapelberg
+ *
+ * xtest.c: drives a screen locker from the outside, the way a user would. It
+ *          starts the given command, waits until the keyboard is grabbed and
+ *          then presses keys through the XTEST extension. It measures
+ *
+ *          - the time from starting the command to the grab,
+ *          - for every key, the time until the pixels in the middle of the
+ *            screen (where the unlock indicator is) changed, read back with
+ *            GetImage,
+ *          - which areas were drawn for every key (DAMAGE on the root
+ *            window), to tell full-screen redraws from indicator updates,
+ *          - with -p, the time from Return to the command exiting and,
+ *            while the password is verified, the time between two frames
+ *            (with -a, while keys are pressed). A password which is rejected
+ *            (the command did not exit within -W ms) is typed again, up to
+ *            -A times.
+ *
+ *          Exits with 1 if one of the limits given on the command line was
+ *          exceeded, with 2 on errors. Used by xvfb-latency.sh and
+ *          pam-latency.sh.
+ *
+ *          With -H ms (and no command), it only grabs the keyboard itself,
+ *          holds the grab for that long and prints when it let go of it
+ *          (CLOCK_MONOTONIC, in microseconds). Exits with 1 if the keyboard
+ *          is grabbed already, i.e. the screen is locked. Used by
+ *          logind-sleep.sh.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <err.h>
+#include <sys/wait.h>
+#include <xcb/xcb.h>
+#include <xcb/xtest.h>
+#include <xcb/damage.h>
+#include <xcb/xinerama.h>
+
+#define XK_Return 0xff0d
+#define XK_Shift_L 0xffe1
+#define XK_Escape 0xff1b
+
+static xcb_connection_t *conn;
+static xcb_screen_t *screen;
+static uint8_t damage_event;
+
+/* The command, 0 once it exited. */
+static pid_t child;
+static int child_status;
+static uint64_t child_exited;
+
+/* The part of the screen which is sampled, around the unlock indicator. */
+static int16_t region_x, region_y;
+static uint16_t region_size = 200;
+
+/* Milliseconds between two keys, also the longest a key may take to show. */
+static int interval = 100;
+
+/* Milliseconds after Return until a password is considered rejected. */
+static int attempt_timeout = 5000;
+
+/* What was drawn in response to a key. */
+typedef struct damage {
+    int rectangles;
+    uint64_t pixels;
+    bool full;
+} damage_t;
+
+typedef struct samples {
+    double *ms;
+    int count;
+    int missed;
+} samples_t;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Returns true if the command is still running. If it exited, reaps it and
+ * remembers when that was noticed.
+ *
+ */
+static bool child_running(void) {
+    if (child == 0)
+        return false;
+    if (waitpid(child, &child_status, WNOHANG) == 0)
+        return true;
+    child = 0;
+    child_exited = now_us();
+    return false;
+}
+
+static void stop_child(void) {
+    if (child_running()) {
+        kill(child, SIGTERM);
+        waitpid(child, &child_status, 0);
+        child = 0;
+    }
+}
+
+/*
+ * Adds everything drawn since the last call to d (if not NULL).
+ *
+ */
+static void collect_damage(damage_t *d) {
+    xcb_generic_event_t *event;
+    while ((event = xcb_poll_for_event(conn)) != NULL) {
+        if ((event->response_type & 0x7f) == damage_event + XCB_DAMAGE_NOTIFY && d != NULL) {
+            const xcb_rectangle_t *area = &((xcb_damage_notify_event_t *)event)->area;
+            const uint64_t pixels = (uint64_t)area->width * area->height;
+            d->rectangles++;
+            d->pixels += pixels;
+            if (pixels * 10 >= (uint64_t)screen->width_in_pixels * screen->height_in_pixels * 9)
+                d->full = true;
+        }
+        free(event);
+    }
+}
+
+static xcb_get_image_reply_t *get_region(void) {
+    xcb_get_image_reply_t *reply = xcb_get_image_reply(conn,
+        xcb_get_image(conn, XCB_IMAGE_FORMAT_Z_PIXMAP, screen->root,
+                      region_x, region_y, region_size, region_size, ~0), NULL);
+    if (reply == NULL)
+        errx(2, "Could not read the screen contents");
+    return reply;
+}
+
+static bool same_pixels(xcb_get_image_reply_t *a, xcb_get_image_reply_t *b) {
+    return (xcb_get_image_data_length(a) == xcb_get_image_data_length(b) &&
+            memcmp(xcb_get_image_data(a), xcb_get_image_data(b), xcb_get_image_data_length(a)) == 0);
+}
+
+/*
+ * Finds the key code and whether Shift is needed for the given keysym, in the
+ * core keyboard mapping.
+ *
+ */
+static xcb_keycode_t find_key(xcb_keysym_t keysym, bool *shift) {
+    const xcb_setup_t *setup = xcb_get_setup(conn);
+    const int count = setup->max_keycode - setup->min_keycode + 1;
+    xcb_get_keyboard_mapping_reply_t *mapping = xcb_get_keyboard_mapping_reply(conn,
+        xcb_get_keyboard_mapping(conn, setup->min_keycode, count), NULL);
+    if (mapping == NULL)
+        errx(2, "Could not get the keyboard mapping");
+
+    const xcb_keysym_t *syms = xcb_get_keyboard_mapping_keysyms(mapping);
+    const int per_key = mapping->keysyms_per_keycode;
+    for (int level = 0; level < 2 && level < per_key; level++) {
+        for (int i = 0; i < count; i++) {
+            if (syms[i * per_key + level] != keysym)
+                continue;
+            free(mapping);
+            *shift = (level == 1);
+            return setup->min_keycode + i;
+        }
+    }
+
+    errx(2, "No key for keysym 0x%x", keysym);
+}
+
+static void fake_key(xcb_keycode_t key, bool press) {
+    xcb_test_fake_input(conn, press ? XCB_KEY_PRESS : XCB_KEY_RELEASE, key,
+                        XCB_CURRENT_TIME, XCB_NONE, 0, 0, 0);
+}
+
+/*
+ * Presses and releases the key for the given keysym (with Shift if needed).
+ * ASCII characters are their own keysyms.
+ *
+ */
+static void type_keysym(xcb_keysym_t keysym) {
+    static xcb_keycode_t shift_key;
+    bool shift;
+    if (shift_key == 0)
+        shift_key = find_key(XK_Shift_L, &shift);
+
+    xcb_keycode_t key = find_key(keysym, &shift);
+    if (shift)
+        fake_key(shift_key, true);
+    fake_key(key, true);
+    fake_key(key, false);
+    if (shift)
+        fake_key(shift_key, false);
+    xcb_flush(conn);
+}
+
+/*
+ * Presses the key and waits (up to interval milliseconds) until the sampled
+ * pixels change. Adds the latency (or a miss) to s and what was drawn until
+ * the next key to d. Returns early if the command exits meanwhile.
+ *
+ */
+static void measure_key(xcb_keysym_t keysym, samples_t *s, damage_t *d) {
+    xcb_get_image_reply_t *before = get_region();
+    const uint64_t start = now_us();
+    const uint64_t end = start + interval * 1000;
+
+    type_keysym(keysym);
+
+    bool changed = false;
+    while (!changed && now_us() < end) {
+        xcb_get_image_reply_t *after = get_region();
+        const uint64_t sampled = now_us();
+        changed = !same_pixels(before, after);
+        free(after);
+        if (changed)
+            s->ms[s->count++] = (sampled - start) / 1000.0;
+        else if (!child_running())
+            break;
+        else
+            usleep(500);
+    }
+    free(before);
+    if (!child_running())
+        return;
+    if (!changed)
+        s->missed++;
+
+    while (now_us() < end && child_running())
+        usleep(1000);
+    collect_damage(d);
+}
+
+/*
+ * Waits until the command grabbed the keyboard. Our own grab succeeding
+ * means it did not yet, so it is released again right away (the screen
+ * locker retries its grab).
+ *
+ */
+static double wait_for_grab(uint64_t start) {
+    while (now_us() - start < 10 * 1000000) {
+        if (!child_running())
+            errx(2, "The command exited before grabbing the keyboard");
+
+        xcb_grab_keyboard_reply_t *reply = xcb_grab_keyboard_reply(conn,
+            xcb_grab_keyboard(conn, false, screen->root, XCB_CURRENT_TIME,
+                              XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC), NULL);
+        const uint64_t probed = now_us();
+        if (reply != NULL && reply->status == XCB_GRAB_STATUS_ALREADY_GRABBED) {
+            free(reply);
+            return (probed - start) / 1000.0;
+        }
+        if (reply != NULL && reply->status == XCB_GRAB_STATUS_SUCCESS)
+            xcb_ungrab_keyboard(conn, XCB_CURRENT_TIME);
+        free(reply);
+        xcb_flush(conn);
+        usleep(1000);
+    }
+
+    errx(2, "The command did not grab the keyboard within 10 s");
+}
+
+/*
+ * Waits until nothing was drawn for 300 ms (the first frame, fading in),
+ * up to 5 s.
+ *
+ */
+static void wait_until_quiet(void) {
+    const uint64_t start = now_us();
+    uint64_t last = start;
+    while (now_us() - last < 300000 && now_us() - start < 5000000) {
+        damage_t d = { 0 };
+        xcb_flush(conn);
+        usleep(10000);
+        free(xcb_get_input_focus_reply(conn, xcb_get_input_focus(conn), NULL));
+        collect_damage(&d);
+        if (d.rectangles > 0)
+            last = now_us();
+    }
+}
+
+/*
+ * Centers the sampled region on the first Xinerama screen (or the root
+ * window), which is where the unlock indicator is drawn.
+ *
+ */
+static void find_region(void) {
+    int x = 0, y = 0, width = screen->width_in_pixels, height = screen->height_in_pixels;
+
+    xcb_xinerama_is_active_reply_t *active = xcb_xinerama_is_active_reply(conn, xcb_xinerama_is_active(conn), NULL);
+    if (active != NULL && active->state) {
+        xcb_xinerama_query_screens_reply_t *screens = xcb_xinerama_query_screens_reply(conn, xcb_xinerama_query_screens(conn), NULL);
+        if (screens != NULL && xcb_xinerama_query_screens_screen_info_length(screens) > 0) {
+            const xcb_xinerama_screen_info_t *first = xcb_xinerama_query_screens_screen_info(screens);
+            x = first->x_org;
+            y = first->y_org;
+            width = first->width;
+            height = first->height;
+        }
+        free(screens);
+    }
+    free(active);
+
+    if (region_size > width || region_size > height)
+        region_size = (width < height ? width : height);
+    region_x = x + (width - region_size) / 2;
+    region_y = y + (height - region_size) / 2;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    const double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(samples_t *s, int p) {
+    return s->ms[(s->count - 1) * p / 100];
+}
+
+static void print_samples(const char *what, samples_t *s) {
+    if (s->count == 0) {
+        printf("%s: no key showed within %d ms (%d keys)\n", what, interval, s->missed);
+        return;
+    }
+    qsort(s->ms, s->count, sizeof(double), compare_doubles);
+    printf("%s (%d keys, %d without a visible change): min %.2f  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f ms\n",
+           what, s->count + s->missed, s->missed, s->ms[0], percentile(s, 50), percentile(s, 90),
+           percentile(s, 99), s->ms[s->count - 1]);
+}
+
+static void add_sample(samples_t *s, double ms) {
+    if ((s->count & (s->count - 1)) == 0 &&
+        (s->ms = realloc(s->ms, (s->count ? s->count * 2 : 1) * sizeof(double))) == NULL)
+        err(2, "realloc()");
+    s->ms[s->count++] = ms;
+}
+
+static void print_gaps(samples_t *s) {
+    if (s->count == 0) {
+        printf("nothing changed on screen while verifying\n");
+        return;
+    }
+    qsort(s->ms, s->count, sizeof(double), compare_doubles);
+    printf("time between frames while verifying (%d frames): p50 %.2f  p90 %.2f  max %.2f ms\n",
+           s->count, percentile(s, 50), percentile(s, 90), s->ms[s->count - 1]);
+}
+
+/*
+ * Watches the screen after Return, until the command exits or attempt_timeout
+ * milliseconds passed, and adds the time between two changes of the sampled
+ * pixels (the spinner turning, the state changing) to gaps. Meanwhile, a key
+ * is pressed every interval milliseconds (up to keys), which the screen
+ * locker has to take without falling behind.
+ *
+ */
+static void watch_verification(uint64_t enter, samples_t *gaps, int keys) {
+    xcb_get_image_reply_t *last = get_region();
+    uint64_t changed = enter, next_key = enter + interval * 1000;
+
+    while (child_running() && now_us() - enter < (uint64_t)attempt_timeout * 1000) {
+        xcb_get_image_reply_t *now = get_region();
+        const uint64_t sampled = now_us();
+        if (!same_pixels(last, now)) {
+            add_sample(gaps, (sampled - changed) / 1000.0);
+            changed = sampled;
+            free(last);
+            last = now;
+        } else {
+            free(now);
+        }
+
+        if (keys > 0 && sampled >= next_key) {
+            type_keysym('a');
+            keys--;
+            next_key += interval * 1000;
+        }
+        usleep(500);
+    }
+    free(last);
+    collect_damage(NULL);
+}
+
+/*
+ * Holds a grab of the keyboard for the given time, see -H above.
+ *
+ */
+static int hold_keyboard(int ms) {
+    xcb_grab_keyboard_reply_t *reply = xcb_grab_keyboard_reply(conn,
+        xcb_grab_keyboard(conn, false, screen->root, XCB_CURRENT_TIME,
+                          XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC), NULL);
+    if (reply == NULL)
+        errx(2, "Could not grab the keyboard");
+    const bool grabbed = (reply->status == XCB_GRAB_STATUS_SUCCESS);
+    free(reply);
+    if (!grabbed) {
+        printf("the keyboard is grabbed already\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("holding the keyboard\n");
+    fflush(stdout);
+    usleep(ms * 1000);
+
+    /* Nobody else can grab it before the X server got the request. */
+    const uint64_t released = now_us();
+    xcb_ungrab_keyboard(conn, XCB_CURRENT_TIME);
+    xcb_flush(conn);
+    printf("released the keyboard at %llu\n", (unsigned long long)released);
+    return EXIT_SUCCESS;
+}
+
+static void usage(void) {
+    errx(2, "Syntax: xtest [-k keys] [-i interval ms] [-r region size]\n"
+            "             [-p password [-A attempts] [-W attempt ms] [-a keys while verifying]]\n"
+            "             [-G max grab ms] [-L max p90 ms] [-M max missed keys] [-F max full redraws]\n"
+            "             [-S max ms between frames while verifying] [-U max unlock ms] -- command...\n"
+            "       xtest -H hold ms");
+}
+
+int main(int argc, char *argv[]) {
+    int keys = 30, keys_verifying = 0, attempts = 1;
+    const char *password = NULL;
+    double max_grab = -1, max_latency = -1, max_unlock = -1, max_gap = -1;
+    int max_missed = -1, max_full = -1, hold = -1;
+    int o;
+
+    while ((o = getopt(argc, argv, "k:i:r:p:A:W:a:G:L:M:F:S:U:H:")) != -1) {
+        switch (o) {
+        case 'k': keys = atoi(optarg); break;
+        case 'i': interval = atoi(optarg); break;
+        case 'r': region_size = atoi(optarg); break;
+        case 'p': password = optarg; break;
+        case 'A': attempts = atoi(optarg); break;
+        case 'W': attempt_timeout = atoi(optarg); break;
+        case 'a': keys_verifying = atoi(optarg); break;
+        case 'G': max_grab = atof(optarg); break;
+        case 'L': max_latency = atof(optarg); break;
+        case 'M': max_missed = atoi(optarg); break;
+        case 'F': max_full = atoi(optarg); break;
+        case 'S': max_gap = atof(optarg); break;
+        case 'U': max_unlock = atof(optarg); break;
+        case 'H': hold = atoi(optarg); break;
+        default: usage();
+        }
+    }
+    if ((hold < 0 && optind >= argc) || keys < 1 || interval < 1 || region_size < 1 || keys_verifying < 0 ||
+        attempts < 1 || attempt_timeout < 1)
+        usage();
+
+    int screen_number;
+    conn = xcb_connect(NULL, &screen_number);
+    if (xcb_connection_has_error(conn))
+        errx(2, "Could not connect to X11, maybe you need to set DISPLAY?");
+    xcb_screen_iterator_t iter = xcb_setup_roots_iterator(xcb_get_setup(conn));
+    for (int i = 0; i < screen_number; i++)
+        xcb_screen_next(&iter);
+    screen = iter.data;
+
+    if (hold >= 0)
+        return hold_keyboard(hold);
+
+    const xcb_query_extension_reply_t *xtest = xcb_get_extension_data(conn, &xcb_test_id);
+    const xcb_query_extension_reply_t *damage = xcb_get_extension_data(conn, &xcb_damage_id);
+    if (xtest == NULL || !xtest->present || damage == NULL || !damage->present)
+        errx(2, "The X server does not support XTEST and DAMAGE");
+    damage_event = damage->first_event;
+    free(xcb_damage_query_version_reply(conn,
+        xcb_damage_query_version(conn, XCB_DAMAGE_MAJOR_VERSION, XCB_DAMAGE_MINOR_VERSION), NULL));
+    find_region();
+
+    /* Everything drawn anywhere on the screen is reported as damage of the
+     * root window. */
+    xcb_damage_create(conn, xcb_generate_id(conn), screen->root, XCB_DAMAGE_REPORT_LEVEL_RAW_RECTANGLES);
+    xcb_flush(conn);
+
+    const uint64_t start = now_us();
+    if ((child = fork()) == -1)
+        err(2, "fork()");
+    if (child == 0) {
+        execvp(argv[optind], argv + optind);
+        err(2, "Could not start %s", argv[optind]);
+    }
+    atexit(stop_child);
+
+    const double grab = wait_for_grab(start);
+    printf("time to grab: %.1f ms\n", grab);
+    wait_until_quiet();
+
+    samples_t latency = { calloc(keys, sizeof(double)), 0, 0 };
+    damage_t total = { 0 };
+    int full = 0;
+    for (int i = 0; i < keys; i++) {
+        damage_t d = { 0 };
+        measure_key('a' + (i % 26), &latency, &d);
+        full += d.full;
+        total.rectangles += d.rectangles;
+        total.pixels += d.pixels;
+        if (!child_running())
+            errx(2, "The command exited while typing");
+    }
+    print_samples("key to pixel latency", &latency);
+    printf("drawn per key: %.1f rectangles, %.0f pixels; full-screen redraws: %d of %d keys\n",
+           (double)total.rectangles / keys, (double)total.pixels / keys, full, keys);
+
+    bool ok = true;
+    if (max_grab >= 0 && grab > max_grab) {
+        printf("FAIL: time to grab %.1f ms > %.1f ms\n", grab, max_grab);
+        ok = false;
+    }
+    if (max_latency >= 0 && (latency.count == 0 || percentile(&latency, 90) > max_latency)) {
+        printf("FAIL: p90 key to pixel latency > %.1f ms\n", max_latency);
+        ok = false;
+    }
+    if (max_missed >= 0 && latency.missed > max_missed) {
+        printf("FAIL: %d keys without a visible change > %d\n", latency.missed, max_missed);
+        ok = false;
+    }
+    if (max_full >= 0 && full > max_full) {
+        printf("FAIL: %d full-screen redraws > %d\n", full, max_full);
+        ok = false;
+    }
+
+    if (password != NULL) {
+        samples_t gaps = { NULL, 0, 0 };
+        uint64_t enter = 0;
+        int attempt;
+        for (attempt = 1; attempt <= attempts && child_running(); attempt++) {
+            /* Start over with an empty password. */
+            type_keysym(XK_Escape);
+            usleep(interval * 1000);
+            for (const char *c = password; *c != '\0'; c++)
+                type_keysym((unsigned char)*c);
+
+            enter = now_us();
+            type_keysym(XK_Return);
+            watch_verification(enter, &gaps, keys_verifying);
+        }
+        print_gaps(&gaps);
+        if (max_gap >= 0 && gaps.count > 0 && gaps.ms[gaps.count - 1] > max_gap) {
+            printf("FAIL: %.1f ms without a new frame while verifying > %.1f ms\n",
+                   gaps.ms[gaps.count - 1], max_gap);
+            ok = false;
+        }
+
+        if (child_running()) {
+            printf("FAIL: still locked after %d attempts\n", attempts);
+            ok = false;
+        } else {
+            const double unlock = (child_exited - enter) / 1000.0;
+            printf("Return to exit: %.1f ms, attempt %d (exit status %d)\n", unlock, attempt - 1,
+                   WIFEXITED(child_status) ? WEXITSTATUS(child_status) : -1);
+            if (max_unlock >= 0 && unlock > max_unlock) {
+                printf("FAIL: Return to exit %.1f ms > %.1f ms\n", unlock, max_unlock);
+                ok = false;
+            }
+        }
+    } else {
+        /* With --debug, i3lock prints its statistics on SIGUSR2, otherwise
+         * SIGUSR2 ends it like SIGTERM would. */
+        if (child_running()) {
+            kill(child, SIGUSR2);
+            usleep(100000);
+        }
+        stop_child();
+    }
+
+    xcb_disconnect(conn);
+    return (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Locks the screen of an Xvfb with i3lock -n and types through XTEST (see
+# xtest.c), once with a single 1080p screen and once with three of them
+# joined by Xinerama (SCREENS="1 3"). Fails if
+#
+# - locking (the keyboard grab) takes longer than MAX_GRAB_MS (500),
+# - the 90th percentile of the time from a key to the unlock indicator
+#   changing on screen is above MAX_LATENCY_MS (30),
+# - more than MAX_MISSED (1) of the KEYS (30) keys did not change it at all,
+# - more than MAX_FULL_REDRAWS (0) keys made i3lock redraw the whole screen.
+#
+cd "$(dirname "$0")/.." || exit 1
+. tests/xvfb.sh
+
+[ -x ./i3lock ] || fail "i3lock is not built"
+[ -x tests/xtest ] || skip "tests/xtest is not built (it needs xcb-xtest and xcb-damage)"
+
+for screens in ${SCREENS:-1 3}; do
+    args=
+    i=0
+    while [ $i -lt "$screens" ]; do
+        args="$args -screen $i 1920x1080x24"
+        i=$((i + 1))
+    done
+    [ "$screens" -eq 1 ] || args="$args +xinerama"
+
+    start_xvfb $args
+    echo "$screens screen(s):"
+    tests/xtest -k "${KEYS:-30}" -G "${MAX_GRAB_MS:-500}" -L "${MAX_LATENCY_MS:-30}" \
+        -M "${MAX_MISSED:-1}" -F "${MAX_FULL_REDRAWS:-0}" -- ./i3lock -n --debug ||
+        fail "with $screens screen(s), see above"
+    stop_xvfb
+done
+echo "xvfb-latency: ok"
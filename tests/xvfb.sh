@@ -0,0 +1,61 @@
+# Sourced by the tests which need an X server (make test-x11). Starts an
+# Xvfb on a free display, with the arguments given to start_xvfb (e.g. more
+# screens and +xinerama), and stops it (and everything else started in $tmp)
+# on exit.
+#
+# A test which cannot run here (no Xvfb, no strace, ...) calls skip, which
+# exits successfully, so that make test-x11 does not fail on a machine
+# without these tools.
+
+tmp=$(mktemp -d)
+xvfb_pid=
+
+cleanup() {
+    [ -z "$xvfb_pid" ] || kill "$xvfb_pid" 2>/dev/null
+    rm -rf "$tmp"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+skip() {
+    echo "$(basename "$0"): skipped, $*"
+    exit 0
+}
+
+fail() {
+    echo "$(basename "$0"): FAILED, $*"
+    exit 1
+}
+
+require() {
+    for tool in "$@"; do
+        command -v "$tool" >/dev/null 2>&1 || skip "$tool not found"
+    done
+}
+
+# Waits up to 5 seconds until the given file is not empty.
+wait_for_file() {
+    i=0
+    while [ ! -s "$1" ]; do
+        i=$((i + 1))
+        [ $i -le 500 ] || return 1
+        sleep 0.01
+    done
+}
+
+start_xvfb() {
+    require Xvfb
+    # Xvfb writes the display number it picked to the -displayfd once it
+    # accepts connections.
+    Xvfb -displayfd 5 -nolisten tcp "$@" 5>"$tmp/display" 2>"$tmp/xvfb.log" &
+    xvfb_pid=$!
+    wait_for_file "$tmp/display" || fail "Xvfb did not start: $(cat "$tmp/xvfb.log")"
+    DISPLAY=:$(cat "$tmp/display")
+    export DISPLAY
+}
+
+stop_xvfb() {
+    [ -z "$xvfb_pid" ] || { kill "$xvfb_pid"; wait "$xvfb_pid"; } 2>/dev/null
+    xvfb_pid=
+    rm -f "$tmp/display"
+}
@@ -0,0 +1,227 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010-2012 Michael Stapelberg
+ *
+ * theme.c: the colors and the geometry of the lock screen. They are parsed
+ *          once at startup (from the defaults, the theme file and -c) into
+ *          ready-to-use RGB values and cairo patterns, so that drawing does
+ *          not need to parse anything.
+ *
+ * A theme file contains lines of the form "key = value". Empty lines and lines
+ * starting with # are ignored. Colors are given as rrggbb or rrggbbaa, texts
+ * as they are (without quotes).
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <err.h>
+#include <cairo.h>
+
+#include "theme.h"
+
+theme_t theme;
+
+static const struct {
+    const char *key;
+    size_t offset;
+    const char *value;
+} colors[] = {
+    { "background", offsetof(theme_t, background), "ffffff" },
+    { "inside", offsetof(theme_t, inside), "000000bf" },
+    { "inside-verify", offsetof(theme_t, inside_verify), "0072ffbf" },
+    { "inside-wrong", offsetof(theme_t, inside_wrong), "fa0000bf" },
+    { "ring", offsetof(theme_t, ring), "337d00" },
+    { "ring-verify", offsetof(theme_t, ring_verify), "3300fa" },
+    { "ring-wrong", offsetof(theme_t, ring_wrong), "7d3300" },
+    { "line", offsetof(theme_t, line), "000000" },
+    { "text", offsetof(theme_t, text), "000000" },
+    { "key-highlight", offsetof(theme_t, key_highlight), "33db00" },
+    { "backspace-highlight", offsetof(theme_t, backspace_highlight), "db3300" },
+    { "spinner", offsetof(theme_t, spinner), "0072ff" },
+};
+
+#define COLORS (sizeof(colors) / sizeof(colors[0]))
+
+/*
+ * Parses a color in the format [#]rrggbb or [#]rrggbbaa into color. Returns
+ * false (and leaves color untouched) if it is invalid.
+ *
+ */
+static bool parse_color(theme_color_t *color, const char *value) {
+    if (value[0] == '#')
+        value++;
+
+    size_t len = strlen(value);
+    if (len != 6 && len != 8)
+        return false;
+    for (size_t i = 0; i < len; i++)
+        if (!isxdigit((unsigned char)value[i]))
+            return false;
+
+    unsigned long rgba = strtoul(value, NULL, 16);
+    if (len == 6)
+        rgba = (rgba << 8) | 0xff;
+
+    if (color->pattern != NULL)
+        cairo_pattern_destroy(color->pattern);
+
+    color->rgb = rgba >> 8;
+    color->pattern = cairo_pattern_create_rgba(((rgba >> 24) & 0xff) / 255.0,
+                                               ((rgba >> 16) & 0xff) / 255.0,
+                                               ((rgba >> 8) & 0xff) / 255.0,
+                                               (rgba & 0xff) / 255.0);
+    return true;
+}
+
+static bool parse_number(double *number, const char *value, double min, double max) {
+    char *end;
+    double result = strtod(value, &end);
+    if (*value == '\0' || *end != '\0' || result < min || result > max)
+        return false;
+    *number = result;
+    return true;
+}
+
+static void set_string(char **string, const char *value) {
+    free(*string);
+    if ((*string = strdup(value)) == NULL)
+        err(EXIT_FAILURE, "strdup()");
+}
+
+/*
+ * Updates the space around the unlock indicator after its geometry changed.
+ * The ring is drawn centered on the radius, so it needs half its width.
+ *
+ */
+static void update_geometry(void) {
+    theme.space = theme.radius + (int)(theme.ring_width + 1) / 2;
+}
+
+/*
+ * Sets the given key (as in the theme file) to the given value. Returns false
+ * if the key is unknown or the value is invalid.
+ *
+ */
+bool theme_set(const char *key, const char *value) {
+    for (size_t i = 0; i < COLORS; i++) {
+        if (strcmp(colors[i].key, key) == 0)
+            return parse_color((theme_color_t *)((char *)&theme + colors[i].offset), value);
+    }
+
+    if (strcmp(key, "verifying-text") == 0) {
+        set_string(&theme.verifying_text, value);
+        return true;
+    } else if (strcmp(key, "wrong-text") == 0) {
+        set_string(&theme.wrong_text, value);
+        return true;
+    } else if (strcmp(key, "font") == 0) {
+        set_string(&theme.font, value);
+        return true;
+    }
+
+    double number;
+    if (strcmp(key, "font-size") == 0) {
+        if (!parse_number(&number, value, 1, 500))
+            return false;
+        theme.font_size = number;
+        return true;
+    } else if (strcmp(key, "radius") == 0) {
+        if (!parse_number(&number, value, 10, 1000))
+            return false;
+        theme.radius = number;
+    } else if (strcmp(key, "ring-width") == 0) {
+        if (!parse_number(&number, value, 0, 100))
+            return false;
+        theme.ring_width = number;
+    } else if (strcmp(key, "line-width") == 0) {
+        if (!parse_number(&number, value, 0, 100))
+            return false;
+        theme.line_width = number;
+    } else {
+        return false;
+    }
+
+    update_geometry();
+    return true;
+}
+
+/*
+ * Sets all colors, the geometry and the labels to their defaults.
+ *
+ */
+void theme_init(void) {
+    for (size_t i = 0; i < COLORS; i++)
+        theme_set(colors[i].key, colors[i].value);
+
+    theme.radius = 90;
+    theme.ring_width = 10.0;
+    theme.line_width = 2.0;
+    update_geometry();
+
+    set_string(&theme.verifying_text, "verifying…");
+    set_string(&theme.wrong_text, "wrong!");
+    set_string(&theme.font, "sans-serif");
+    theme.font_size = 28.0;
+}
+
+static char *trim(char *str) {
+    while (isspace((unsigned char)*str))
+        str++;
+
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1]))
+        end--;
+    *end = '\0';
+
+    return str;
+}
+
+/*
+ * Reads the theme file at the given path. Keys which are not given keep
+ * their current values. Returns false (after printing the problem) if the
+ * file cannot be read or contains an invalid line.
+ *
+ */
+bool theme_load(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+
+    char *line = NULL;
+    size_t size = 0;
+    int number = 0;
+    bool ok = true;
+
+    while (ok && getline(&line, &size, file) != -1) {
+        number++;
+
+        char *key = trim(line);
+        if (*key == '\0' || *key == '#')
+            continue;
+
+        char *value = strchr(key, '=');
+        if (value == NULL) {
+            fprintf(stderr, "%s:%d: expected \"key = value\"\n", path, number);
+            ok = false;
+            break;
+        }
+        *value++ = '\0';
+        key = trim(key);
+        value = trim(value);
+
+        if (!theme_set(key, value)) {
+            fprintf(stderr, "%s:%d: invalid key or value: \"%s = %s\"\n", path, number, key, value);
+            ok = false;
+        }
+    }
+
+    free(line);
+    fclose(file);
+    return ok;
+}
@@ -0,0 +1,59 @@
+#ifndef _THEME_H
+#define _THEME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <cairo.h>
+
+/* A color, prepared for both ways we draw with it. */
+typedef struct theme_color {
+    /* rrggbb, without the alpha channel. The X11 pixel value depends on the
+     * visual, see get_pixel(). */
+    uint32_t rgb;
+    /* A solid cairo pattern, including the alpha channel. */
+    cairo_pattern_t *pattern;
+} theme_color_t;
+
+typedef struct theme {
+    theme_color_t background;
+
+    /* The inside of the unlock indicator, depending on the PAM state. */
+    theme_color_t inside;
+    theme_color_t inside_verify;
+    theme_color_t inside_wrong;
+
+    /* The ring around it, depending on the PAM state. */
+    theme_color_t ring;
+    theme_color_t ring_verify;
+    theme_color_t ring_wrong;
+
+    /* The separator lines, the text and the highlighted parts of the ring. */
+    theme_color_t line;
+    theme_color_t text;
+    theme_color_t key_highlight;
+    theme_color_t backspace_highlight;
+    theme_color_t spinner;
+
+    int radius;
+    double ring_width;
+    double line_width;
+
+    /* The labels shown while verifying and after a wrong password, and the
+     * font (family name) and size they are shown in. */
+    char *verifying_text;
+    char *wrong_text;
+    char *font;
+    double font_size;
+
+    /* Derived from the above: the distance from the center of the unlock
+     * indicator to the border of its surface. */
+    int space;
+} theme_t;
+
+extern theme_t theme;
+
+void theme_init(void);
+bool theme_load(const char *path);
+bool theme_set(const char *key, const char *value);
+
+#endif
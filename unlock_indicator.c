@@ -8,8 +8,14 @@
  */
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <math.h>
 #include <xcb/xcb.h>
+#include <xcb/render.h>
 #include <ev.h>
 #include <cairo.h>
 #include <cairo/cairo-xcb.h>
@@ -18,10 +24,13 @@
 #include "unlock_indicator.h"
 #include "xinerama.h"
 #include "wayland.h"
+#include "stats.h"
+#include "filter.h"
+#include "theme.h"
 
-#define BUTTON_RADIUS 90
-#define BUTTON_SPACE (BUTTON_RADIUS + 5)
-#define BUTTON_CENTER (BUTTON_RADIUS + 5)
+#define BUTTON_RADIUS (theme.radius)
+#define BUTTON_SPACE (theme.space)
+#define BUTTON_CENTER (theme.space)
 #define BUTTON_DIAMETER (2 * BUTTON_SPACE)
 
 /*******************************************************************************
@@ -46,247 +55,1055 @@ extern xcb_window_t win;
 /* The current resolution of the X11 root window. */
 extern uint32_t last_resolution[2];
 
+/* Whether --debug was given. */
+extern bool debug_mode;
+
 /* Whether the unlock indicator is enabled (defaults to true). */
 extern bool unlock_indicator;
 
+/* The path of the specified image (-i), if any. */
+extern char *image_path;
+
 /* A Cairo surface containing the specified image (-i), if any. */
 extern cairo_surface_t *img;
 
+/* Whether the decoded image should be freed once it was uploaded to the X
+ * server (--low-memory). */
+extern bool low_memory;
+
 /* Whether the image should be tiled. */
 extern bool tile;
-/* The background color to use (in hex). */
-extern char color[7];
 
 /*******************************************************************************
  * Local variables.
  ******************************************************************************/
 
-static struct ev_timer *clear_indicator_timeout;
+static struct ev_timer clear_indicator_timeout;
+
+/* While PAM verifies the password, a part of the ring rotates so that the user
+ * can see that i3lock is still working. It is redrawn SPINNER_FPS times per
+ * second, which only touches the indicator windows. */
+#define SPINNER_FPS 15
+static struct ev_timer spinner_timeout;
+static double spinner_angle;
+
+/* The labels of the PAM states, shaped once (see prepare_labels()) into
+ * glyphs which are already centered in the unlock indicator. */
+typedef struct label {
+    cairo_glyph_t *glyphs;
+    int num_glyphs;
+} label_t;
 
-/* Cache the screen’s visual, necessary for creating a Cairo context. */
+static cairo_scaled_font_t *label_font;
+static label_t verifying_label;
+static label_t wrong_label;
+static bool labels_prepared = false;
+
+/* Cache the screen’s visual, necessary for creating a Cairo context, and the
+ * cairo format which matches it (see get_native_format()). */
 static xcb_visualtype_t *vistype;
+static cairo_format_t native_format = CAIRO_FORMAT_INVALID;
+
+/* Statistics about every frame, printed in debug mode. A frame is one update
+ * of the indicator windows (X11) or of the whole window (Wayland). */
+static histogram_t render_time = { .name = "render time (ns/frame)" };
+static histogram_t render_bytes = { .name = "pixel bytes written per frame" };
+static histogram_t render_surfaces = { .name = "surfaces allocated per frame" };
+/* The number of frames drawn so far, see drawn_frames(). */
+static uint64_t frames_drawn = 0;
+#ifndef BACKEND_WAYLAND
+/* How long it takes from redraw_screen() until the X server has drawn the
+ * frame (X11, debug mode only), and how often the whole background had to be
+ * drawn again (as opposed to only the indicator). */
+static histogram_t frame_latency = { .name = "redraw to X server done (ns)" };
+/* What each frame costs on the wire (X11, debug mode only). The event loop
+ * thread might send requests at the same time, which are counted as well. */
+static histogram_t frame_requests = { .name = "X requests per frame" };
+static histogram_t frame_bytes = { .name = "X bytes sent per frame" };
+static histogram_t frame_flushes = { .name = "X flushes per frame" };
+static int background_redraws = 0;
+#endif
 
 /* Maintain the current unlock/PAM state to draw the appropriate unlock
- * indicator. */
+ * indicator. Only the event loop thread reads and writes them, drawing works
+ * on a frame_t snapshot (see snapshot_frame()). */
 unlock_state_t unlock_state;
 pam_state_t pam_state;
 
-void draw_image_core(cairo_t *screen_ctx, uint32_t *resolution) {
-    /* Initialize cairo: Create one in-memory surface to render the unlock
-     * indicator on, create one XCB surface to actually draw (one or more,
-     * depending on the amount of screens) unlock indicators on. */
-    cairo_surface_t *output = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, BUTTON_DIAMETER, BUTTON_DIAMETER);
-    cairo_t *ctx = cairo_create(output);
+/* The state the unlock indicator is drawn from. With X11, redraw_screen()
+ * takes a snapshot of it and hands it to the render thread through the
+ * mailbox (see below), so that drawing (and waiting for the X socket) never
+ * delays handling the next key or PAM, and the render thread never reads
+ * unlock_state and pam_state while the event loop thread changes them. */
+typedef struct frame {
+    unlock_state_t unlock_state;
+    pam_state_t pam_state;
+    double spinner_angle;
+    double highlight_angle;
+    /* When redraw_screen() was called, for frame_latency. */
+    uint64_t posted;
+} frame_t;
+
+/* The server-side copy of the background (color or image, without the unlock
+ * indicator). The indicator windows copy their part of it before compositing
+ * the indicator on top, so the background never has to be re-rendered. */
+static xcb_pixmap_t bg_pixmap = XCB_NONE;
+/* Whether bg_pixmap only contains one tile of the background (-t). */
+static bool bg_tiled = false;
+/* The XRender picture of bg_pixmap, created when it is first needed. */
+static xcb_render_picture_t bg_picture = XCB_NONE;
+
+/* One small child window per screen which displays the unlock indicator, and
+ * the pixmaps (with their XRender pictures) the indicator is composited on. */
+static xcb_window_t *indicator_windows;
+static int indicator_windows_count;
+static bool indicator_windows_mapped;
+static xcb_pixmap_t *indicator_pixmaps;
+static xcb_render_picture_t *indicator_pictures;
+/* For each indicator window and PAM state, the base layer of the indicator
+ * already composited onto the background underneath that window, in the
+ * format of the root window (see create_indicator_pictures()). */
+static xcb_render_picture_t *indicator_bases;
+/* The top left corner of each indicator window, see indicator_position(). */
+static xcb_point_t *indicator_positions;
 
+/*
+ * Decodes the PNG image given with -i into img and applies the effects (-e)
+ * to it. In case loading fails, we just pretend no -i was specified.
+ *
+ */
+void load_image(void) {
+    img = cairo_image_surface_create_from_png(image_path);
+    if (cairo_surface_status(img) != CAIRO_STATUS_SUCCESS) {
+        fprintf(stderr, "Could not load image \"%s\": cairo surface status %d\n",
+                image_path, cairo_surface_status(img));
+        cairo_surface_destroy(img);
+        img = NULL;
+        return;
+    }
 
+    apply_effects(img);
+}
+
+/*
+ * Fills the given context with the background color or image (-i).
+ *
+ */
+static void draw_background(cairo_t *ctx, uint32_t *resolution) {
     if (img) {
         if (!tile) {
-            cairo_set_source_surface(screen_ctx, img, 0, 0);
-            cairo_paint(screen_ctx);
+            cairo_set_source_surface(ctx, img, 0, 0);
+            cairo_paint(ctx);
         } else {
             /* create a pattern and fill a rectangle as big as the screen */
             cairo_pattern_t *pattern;
             pattern = cairo_pattern_create_for_surface(img);
-            cairo_set_source(screen_ctx, pattern);
+            cairo_set_source(ctx, pattern);
             cairo_pattern_set_extend(pattern, CAIRO_EXTEND_REPEAT);
-            cairo_rectangle(screen_ctx, 0, 0, resolution[0], resolution[1]);
-            cairo_fill(screen_ctx);
+            cairo_rectangle(ctx, 0, 0, resolution[0], resolution[1]);
+            cairo_fill(ctx);
             cairo_pattern_destroy(pattern);
         }
     } else {
-        char strgroups[3][3] = {{color[0], color[1], '\0'},
-                                {color[2], color[3], '\0'},
-                                {color[4], color[5], '\0'}};
-        uint32_t rgb16[3] = {(strtol(strgroups[0], NULL, 16)),
-                             (strtol(strgroups[1], NULL, 16)),
-                             (strtol(strgroups[2], NULL, 16))};
-        cairo_set_source_rgb(screen_ctx, rgb16[0] / 255.0, rgb16[1] / 255.0, rgb16[2] / 255.0);
-        cairo_rectangle(screen_ctx, 0, 0, resolution[0], resolution[1]);
-        cairo_fill(screen_ctx);
+        cairo_set_source(ctx, theme.background.pattern);
+        cairo_rectangle(ctx, 0, 0, resolution[0], resolution[1]);
+        cairo_fill(ctx);
     }
+}
 
-    if (unlock_state >= STATE_KEY_PRESSED && unlock_indicator) {
-        /* Draw a (centered) circle with transparent background. */
-        cairo_set_line_width(ctx, 10.0);
-        cairo_arc(ctx,
-                  BUTTON_CENTER /* x */,
-                  BUTTON_CENTER /* y */,
-                  BUTTON_RADIUS /* radius */,
-                  0 /* start */,
-                  2 * M_PI /* end */);
-
-        /* Use the appropriate color for the different PAM states
-         * (currently verifying, wrong password, or default) */
-        switch (pam_state) {
-            case STATE_PAM_VERIFY:
-                cairo_set_source_rgba(ctx, 0, 114.0/255, 255.0/255, 0.75);
-                break;
-            case STATE_PAM_WRONG:
-                cairo_set_source_rgba(ctx, 250.0/255, 0, 0, 0.75);
-                break;
-            default:
-                cairo_set_source_rgba(ctx, 0, 0, 0, 0.75);
-                break;
-        }
-        cairo_fill_preserve(ctx);
-
-        switch (pam_state) {
-            case STATE_PAM_VERIFY:
-                cairo_set_source_rgb(ctx, 51.0/255, 0, 250.0/255);
-                break;
-            case STATE_PAM_WRONG:
-                cairo_set_source_rgb(ctx, 125.0/255, 51.0/255, 0);
-                break;
-            case STATE_PAM_IDLE:
-                cairo_set_source_rgb(ctx, 51.0/255, 125.0/255, 0);
-                break;
-        }
-        cairo_stroke(ctx);
-
-        /* Draw an inner seperator line. */
-        cairo_set_source_rgb(ctx, 0, 0, 0);
-        cairo_set_line_width(ctx, 2.0);
-        cairo_arc(ctx,
-                  BUTTON_CENTER /* x */,
-                  BUTTON_CENTER /* y */,
-                  BUTTON_RADIUS - 5 /* radius */,
-                  0,
-                  2 * M_PI);
-        cairo_stroke(ctx);
-
-        cairo_set_line_width(ctx, 10.0);
-
-        /* Display a (centered) text of the current PAM state. */
-        char *text = NULL;
-        switch (pam_state) {
-            case STATE_PAM_VERIFY:
-                text = "verifying…";
-                break;
-            case STATE_PAM_WRONG:
-                text = "wrong!";
-                break;
-            default:
-                break;
+/*
+ * Returns true if the unlock indicator should be visible in the given frame.
+ *
+ */
+static bool indicator_visible(const frame_t *frame) {
+    return (frame->unlock_state >= STATE_KEY_PRESSED && unlock_indicator);
+}
+
+/*
+ * Converts the given text into glyphs of label_font, centered in the unlock
+ * indicator.
+ *
+ */
+static void shape_label(label_t *label, const char *text) {
+    cairo_text_extents_t extents;
+
+    if (*text == '\0')
+        return;
+
+    if (cairo_scaled_font_text_to_glyphs(label_font, 0, 0, text, -1,
+                                         &label->glyphs, &label->num_glyphs,
+                                         NULL, NULL, NULL) != CAIRO_STATUS_SUCCESS) {
+        label->glyphs = NULL;
+        label->num_glyphs = 0;
+        return;
+    }
+
+    cairo_scaled_font_glyph_extents(label_font, label->glyphs, label->num_glyphs, &extents);
+    double x = BUTTON_CENTER - ((extents.width / 2) + extents.x_bearing);
+    double y = BUTTON_CENTER - ((extents.height / 2) + extents.y_bearing);
+    for (int i = 0; i < label->num_glyphs; i++) {
+        label->glyphs[i].x += x;
+        label->glyphs[i].y += y;
+    }
+}
+
+/*
+ * Looks up the font of the theme and lays out the labels. This happens only
+ * once, the theme cannot change while i3lock is running.
+ *
+ */
+static void prepare_labels(void) {
+    cairo_matrix_t font_matrix, ctm;
+
+    labels_prepared = true;
+
+    cairo_font_face_t *face = cairo_toy_font_face_create(theme.font,
+                                                         CAIRO_FONT_SLANT_NORMAL,
+                                                         CAIRO_FONT_WEIGHT_NORMAL);
+    cairo_font_options_t *options = cairo_font_options_create();
+    cairo_matrix_init_scale(&font_matrix, theme.font_size, theme.font_size);
+    cairo_matrix_init_identity(&ctm);
+    label_font = cairo_scaled_font_create(face, &font_matrix, &ctm, options);
+    cairo_font_options_destroy(options);
+    cairo_font_face_destroy(face);
+
+    if (cairo_scaled_font_status(label_font) != CAIRO_STATUS_SUCCESS) {
+        fprintf(stderr, "Could not load font \"%s\", not displaying any text\n", theme.font);
+        return;
+    }
+
+    shape_label(&verifying_label, theme.verifying_text);
+    shape_label(&wrong_label, theme.wrong_text);
+}
+
+/*
+ * Draws the parts of the unlock indicator which only depend on the PAM state:
+ * the circle, the ring, the inner separator line and the label.
+ *
+ */
+static void draw_indicator_base(cairo_t *ctx, pam_state_t state) {
+    /* Draw a (centered) circle with transparent background. */
+    cairo_set_line_width(ctx, theme.ring_width);
+    cairo_arc(ctx,
+              BUTTON_CENTER /* x */,
+              BUTTON_CENTER /* y */,
+              BUTTON_RADIUS /* radius */,
+              0 /* start */,
+              2 * M_PI /* end */);
+
+    /* Use the appropriate color for the different PAM states
+     * (currently verifying, wrong password, or default) */
+    switch (state) {
+        case STATE_PAM_VERIFY:
+            cairo_set_source(ctx, theme.inside_verify.pattern);
+            break;
+        case STATE_PAM_WRONG:
+            cairo_set_source(ctx, theme.inside_wrong.pattern);
+            break;
+        default:
+            cairo_set_source(ctx, theme.inside.pattern);
+            break;
+    }
+    cairo_fill_preserve(ctx);
+
+    switch (state) {
+        case STATE_PAM_VERIFY:
+            cairo_set_source(ctx, theme.ring_verify.pattern);
+            break;
+        case STATE_PAM_WRONG:
+            cairo_set_source(ctx, theme.ring_wrong.pattern);
+            break;
+        case STATE_PAM_IDLE:
+            cairo_set_source(ctx, theme.ring.pattern);
+            break;
+    }
+    cairo_stroke(ctx);
+
+    /* Draw an inner seperator line. */
+    cairo_set_source(ctx, theme.line.pattern);
+    cairo_set_line_width(ctx, theme.line_width);
+    cairo_arc(ctx,
+              BUTTON_CENTER /* x */,
+              BUTTON_CENTER /* y */,
+              BUTTON_RADIUS - (theme.ring_width / 2) /* radius */,
+              0,
+              2 * M_PI);
+    cairo_stroke(ctx);
+
+    /* Display a (centered) text of the current PAM state. */
+    label_t *label = NULL;
+    switch (state) {
+        case STATE_PAM_VERIFY:
+            label = &verifying_label;
+            break;
+        case STATE_PAM_WRONG:
+            label = &wrong_label;
+            break;
+        default:
+            break;
+    }
+
+    if (label) {
+        if (!labels_prepared)
+            prepare_labels();
+
+        if (label->num_glyphs > 0) {
+            cairo_set_source(ctx, theme.text.pattern);
+            cairo_set_scaled_font(ctx, label_font);
+            cairo_show_glyphs(ctx, label->glyphs, label->num_glyphs);
         }
+    }
+}
 
-        if (text) {
-            cairo_text_extents_t extents;
-            double x, y;
+/*
+ * Draws the spinner (shown while verifying) starting at angle 0. The part of
+ * the inner separator line which it covers is drawn again on top of it.
+ *
+ */
+static void draw_indicator_spinner(cairo_t *ctx) {
+    cairo_set_source(ctx, theme.spinner.pattern);
+    cairo_set_line_width(ctx, theme.ring_width);
+    cairo_arc(ctx,
+              BUTTON_CENTER /* x */,
+              BUTTON_CENTER /* y */,
+              BUTTON_RADIUS /* radius */,
+              0 /* start */,
+              M_PI / 2.0 /* end */);
+    cairo_stroke(ctx);
 
-            cairo_set_source_rgb(ctx, 0, 0, 0);
-            cairo_set_font_size(ctx, 28.0);
+    cairo_set_source(ctx, theme.line.pattern);
+    cairo_set_line_width(ctx, theme.line_width);
+    cairo_arc(ctx,
+              BUTTON_CENTER /* x */,
+              BUTTON_CENTER /* y */,
+              BUTTON_RADIUS - (theme.ring_width / 2) /* radius */,
+              0 /* start */,
+              M_PI / 2.0 /* end */);
+    cairo_stroke(ctx);
+}
 
-            cairo_text_extents(ctx, text, &extents);
-            x = BUTTON_CENTER - ((extents.width / 2) + extents.x_bearing);
-            y = BUTTON_CENTER - ((extents.height / 2) + extents.y_bearing);
+/*
+ * Draws the highlighted part of the ring which confirms a keypress, starting
+ * at angle 0.
+ *
+ */
+static void draw_indicator_highlight(cairo_t *ctx, bool backspace) {
+    cairo_set_line_width(ctx, theme.ring_width);
+    cairo_new_sub_path(ctx);
+    cairo_arc(ctx,
+              BUTTON_CENTER /* x */,
+              BUTTON_CENTER /* y */,
+              BUTTON_RADIUS /* radius */,
+              0,
+              M_PI / 3.0);
+    if (!backspace) {
+        /* For normal keys, we use a lighter green. */
+        cairo_set_source(ctx, theme.key_highlight.pattern);
+    } else {
+        /* For backspace, we use red. */
+        cairo_set_source(ctx, theme.backspace_highlight.pattern);
+    }
+    cairo_stroke(ctx);
+
+    /* Draw two little separators for the highlighted part of the
+     * unlock indicator. */
+    cairo_set_source(ctx, theme.line.pattern);
+    cairo_arc(ctx,
+              BUTTON_CENTER /* x */,
+              BUTTON_CENTER /* y */,
+              BUTTON_RADIUS /* radius */,
+              0 /* start */,
+              M_PI / 128.0 /* end */);
+    cairo_stroke(ctx);
+    cairo_arc(ctx,
+              BUTTON_CENTER /* x */,
+              BUTTON_CENTER /* y */,
+              BUTTON_RADIUS /* radius */,
+              M_PI / 3.0 /* start */,
+              (M_PI / 3.0) + (M_PI / 128.0) /* end */);
+    cairo_stroke(ctx);
+}
+
+/*
+ * Returns the angle at which the highlight starts. After the user pressed any
+ * valid key or the backspace key, we highlight a random part of the unlock
+ * indicator to confirm this keypress.
+ *
+ */
+static double highlight_angle(void) {
+    return (rand() % (int)(2 * M_PI * 100)) / 100.0;
+}
 
-            cairo_move_to(ctx, x, y);
-            cairo_show_text(ctx, text);
-            cairo_close_path(ctx);
+/*
+ * Takes a snapshot of the state the unlock indicator is drawn from. Must be
+ * called on the event loop thread.
+ *
+ */
+static void snapshot_frame(frame_t *frame) {
+    frame->unlock_state = unlock_state;
+    frame->pam_state = pam_state;
+    frame->spinner_angle = spinner_angle;
+    frame->posted = now_ns();
+    if (unlock_state == STATE_KEY_ACTIVE || unlock_state == STATE_BACKSPACE_ACTIVE)
+        frame->highlight_angle = highlight_angle();
+}
+
+/*
+ * Rotates the context by the given angle around the center of the unlock
+ * indicator.
+ *
+ */
+static void rotate_indicator(cairo_t *ctx, double angle) {
+    cairo_translate(ctx, BUTTON_CENTER, BUTTON_CENTER);
+    cairo_rotate(ctx, angle);
+    cairo_translate(ctx, -BUTTON_CENTER, -BUTTON_CENTER);
+}
+
+/*
+ * Renders the unlock indicator for the unlock/PAM state of the given frame
+ * onto a new in-memory surface of BUTTON_DIAMETER x BUTTON_DIAMETER pixels.
+ * The caller has to destroy the surface.
+ *
+ */
+static cairo_surface_t *draw_indicator(const frame_t *frame) {
+    cairo_surface_t *output = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, BUTTON_DIAMETER, BUTTON_DIAMETER);
+    cairo_t *ctx = cairo_create(output);
+
+    if (indicator_visible(frame)) {
+        draw_indicator_base(ctx, frame->pam_state);
+
+        if (frame->pam_state == STATE_PAM_VERIFY) {
+            cairo_save(ctx);
+            rotate_indicator(ctx, frame->spinner_angle);
+            draw_indicator_spinner(ctx);
+            cairo_restore(ctx);
         }
 
-        /* After the user pressed any valid key or the backspace key, we
-         * highlight a random part of the unlock indicator to confirm this
-         * keypress. */
-        if (unlock_state == STATE_KEY_ACTIVE ||
-            unlock_state == STATE_BACKSPACE_ACTIVE) {
-            cairo_new_sub_path(ctx);
-            double highlight_start = (rand() % (int)(2 * M_PI * 100)) / 100.0;
-            cairo_arc(ctx,
-                      BUTTON_CENTER /* x */,
-                      BUTTON_CENTER /* y */,
-                      BUTTON_RADIUS /* radius */,
-                      highlight_start,
-                      highlight_start + (M_PI / 3.0));
-            if (unlock_state == STATE_KEY_ACTIVE) {
-                /* For normal keys, we use a lighter green. */
-                cairo_set_source_rgb(ctx, 51.0/255, 219.0/255, 0);
-            } else {
-                /* For backspace, we use red. */
-                cairo_set_source_rgb(ctx, 219.0/255, 51.0/255, 0);
-            }
-            cairo_stroke(ctx);
-
-            /* Draw two little separators for the highlighted part of the
-             * unlock indicator. */
-            cairo_set_source_rgb(ctx, 0, 0, 0);
-            cairo_arc(ctx,
-                      BUTTON_CENTER /* x */,
-                      BUTTON_CENTER /* y */,
-                      BUTTON_RADIUS /* radius */,
-                      highlight_start /* start */,
-                      highlight_start + (M_PI / 128.0) /* end */);
-            cairo_stroke(ctx);
-            cairo_arc(ctx,
-                      BUTTON_CENTER /* x */,
-                      BUTTON_CENTER /* y */,
-                      BUTTON_RADIUS /* radius */,
-                      highlight_start + (M_PI / 3.0) /* start */,
-                      (highlight_start + (M_PI / 3.0)) + (M_PI / 128.0) /* end */);
-            cairo_stroke(ctx);
+        if (frame->unlock_state == STATE_KEY_ACTIVE ||
+            frame->unlock_state == STATE_BACKSPACE_ACTIVE) {
+            cairo_save(ctx);
+            rotate_indicator(ctx, frame->highlight_angle);
+            draw_indicator_highlight(ctx, frame->unlock_state == STATE_BACKSPACE_ACTIVE);
+            cairo_restore(ctx);
         }
     }
 
+    cairo_destroy(ctx);
+    return output;
+}
+
+/*
+ * Returns the top left corner of the unlock indicator on the given screen
+ * (relative to the root window).
+ *
+ */
+static void indicator_position(int screen, int *x, int *y) {
     if (xr_screens > 0) {
-        /* Composite the unlock indicator in the middle of each screen. */
-        for (int screen = 0; screen < xr_screens; screen++) {
-            int x = (xr_resolutions[screen].x + ((xr_resolutions[screen].width / 2) - (BUTTON_DIAMETER / 2)));
-            int y = (xr_resolutions[screen].y + ((xr_resolutions[screen].height / 2) - (BUTTON_DIAMETER / 2)));
-            cairo_set_source_surface(screen_ctx, output, x, y);
-            cairo_rectangle(screen_ctx, x, y, BUTTON_DIAMETER, BUTTON_DIAMETER);
-            cairo_fill(screen_ctx);
-        }
+        *x = (xr_resolutions[screen].x + ((xr_resolutions[screen].width / 2) - (BUTTON_DIAMETER / 2)));
+        *y = (xr_resolutions[screen].y + ((xr_resolutions[screen].height / 2) - (BUTTON_DIAMETER / 2)));
     } else {
         /* We have no information about the screen sizes/positions, so we just
          * place the unlock indicator in the middle of the X root window and
          * hope for the best. */
-        int x = (last_resolution[0] / 2) - (BUTTON_DIAMETER / 2);
-        int y = (last_resolution[1] / 2) - (BUTTON_DIAMETER / 2);
+        *x = (last_resolution[0] / 2) - (BUTTON_DIAMETER / 2);
+        *y = (last_resolution[1] / 2) - (BUTTON_DIAMETER / 2);
+    }
+}
+
+/*
+ * Draws the background and (if visible) the unlock indicator in the middle of
+ * each screen onto the given context. Used by backends which render the whole
+ * window on every frame, on the event loop thread.
+ *
+ */
+void draw_image_core(cairo_t *screen_ctx, uint32_t *resolution) {
+    uint64_t start = now_ns();
+    __atomic_add_fetch(&frames_drawn, 1, __ATOMIC_RELAXED);
+
+    frame_t frame;
+    snapshot_frame(&frame);
+    draw_background(screen_ctx, resolution);
+
+    if (!indicator_visible(&frame)) {
+        histogram_add(&render_time, now_ns() - start);
+        histogram_add(&render_bytes, resolution[0] * resolution[1] * 4);
+        histogram_add(&render_surfaces, 0);
+        return;
+    }
+
+    /* Initialize cairo: Create one in-memory surface to render the unlock
+     * indicator on, then composite it onto the screen (one or more times,
+     * depending on the amount of screens). */
+    cairo_surface_t *output = draw_indicator(&frame);
+    int screens = (xr_screens > 0 ? xr_screens : 1);
+    for (int screen = 0; screen < screens; screen++) {
+        int x, y;
+        indicator_position(screen, &x, &y);
         cairo_set_source_surface(screen_ctx, output, x, y);
         cairo_rectangle(screen_ctx, x, y, BUTTON_DIAMETER, BUTTON_DIAMETER);
         cairo_fill(screen_ctx);
     }
 
     cairo_surface_destroy(output);
-    cairo_destroy(ctx);
+
+    histogram_add(&render_time, now_ns() - start);
+    histogram_add(&render_bytes, (resolution[0] * resolution[1] +
+                                  (1 + screens) * BUTTON_DIAMETER * BUTTON_DIAMETER) * 4);
+    histogram_add(&render_surfaces, 1);
 }
 
 /*
- * Draws global image with fill color onto a pixmap with the given
- * resolution and returns it.
+ * Draws the background (color or image, without the unlock indicator) onto a
+ * pixmap with the given resolution and returns it. The pixmap is kept as the
+ * source for the indicator windows and freed on the next call, so the caller
+ * must not free it.
+ *
+ * When tiling (-t), the pixmap only contains the image itself: the X server
+ * repeats the background pixmap of a window if it is smaller than the
+ * window, so there is no need to render the tiles ourselves. Since the tile
+ * does not depend on the resolution, it is only uploaded once.
+ *
+ * In low memory mode, the image is only decoded for as long as it takes to
+ * upload it, since the X server keeps its own copy in the pixmap anyway. Images
+ * which cannot be loaded again (--image-fd, the screenshot) are kept.
  *
  */
 xcb_pixmap_t draw_image(uint32_t *resolution) {
-    xcb_pixmap_t bg_pixmap = XCB_NONE;
+    if (bg_tiled && tile)
+        return bg_pixmap;
 
-    if (!vistype)
+    if (low_memory && img == NULL && image_path != NULL)
+        load_image();
+
+    if (!vistype) {
         vistype = get_root_visual_type(screen);
-    bg_pixmap = create_bg_pixmap(conn, screen, resolution, color);
-    cairo_surface_t *xcb_output = cairo_xcb_surface_create(conn, bg_pixmap, vistype, resolution[0], resolution[1]);
+        native_format = get_native_format(conn, screen);
+    }
+    if (bg_pixmap != XCB_NONE)
+        xcb_free_pixmap(conn, bg_pixmap);
+    if (bg_picture != XCB_NONE) {
+        xcb_render_free_picture(conn, bg_picture);
+        bg_picture = XCB_NONE;
+    }
+
+    bg_tiled = (tile && img != NULL);
+    uint32_t size[2] = { resolution[0], resolution[1] };
+    if (bg_tiled) {
+        size[0] = cairo_image_surface_get_width(img);
+        size[1] = cairo_image_surface_get_height(img);
+    }
+
+    bg_pixmap = create_bg_pixmap(conn, screen, size, get_pixel(screen, theme.background.rgb));
+    cairo_surface_t *xcb_output = cairo_xcb_surface_create(conn, bg_pixmap, vistype, size[0], size[1]);
     cairo_t *xcb_ctx = cairo_create(xcb_output);
 
-    draw_image_core(xcb_ctx, resolution);
+    if (img != NULL && native_format != CAIRO_FORMAT_INVALID) {
+        /* Convert the image into the format of the root window once, on our
+         * side, so that uploading it is a plain copy instead of a conversion
+         * by cairo or the X server. */
+        cairo_surface_t *native = cairo_image_surface_create(native_format, size[0], size[1]);
+        cairo_t *ctx = cairo_create(native);
+        /* The components of the color, so that cairo converts them for 16
+         * and 30 bit as well. Like the pixel value of the window background,
+         * the color is opaque. */
+        double red, green, blue, alpha;
+        cairo_pattern_get_rgba(theme.background.pattern, &red, &green, &blue, &alpha);
+        cairo_set_source_rgb(ctx, red, green, blue);
+        cairo_paint(ctx);
+        if (bg_tiled) {
+            cairo_set_source_surface(ctx, img, 0, 0);
+            cairo_paint(ctx);
+        } else draw_background(ctx, resolution);
+        cairo_destroy(ctx);
+
+        cairo_set_operator(xcb_ctx, CAIRO_OPERATOR_SOURCE);
+        cairo_set_source_surface(xcb_ctx, native, 0, 0);
+        cairo_paint(xcb_ctx);
+        cairo_surface_destroy(native);
+    } else if (bg_tiled) {
+        cairo_set_source_surface(xcb_ctx, img, 0, 0);
+        cairo_paint(xcb_ctx);
+    } else draw_background(xcb_ctx, resolution);
 
     cairo_surface_destroy(xcb_output);
     cairo_destroy(xcb_ctx);
+
+    if (low_memory && img != NULL && image_path != NULL) {
+        cairo_surface_destroy(img);
+        img = NULL;
+    }
+
     return bg_pixmap;
 }
 
 /*
- * Calls draw_image on a new pixmap and swaps that with the current pixmap
+ * (Re-)creates one indicator window for each screen, centered on that screen.
+ * Called after the lock window was opened and whenever the screen
+ * configuration changes.
+ *
+ */
+void position_indicator_windows(void) {
+    for (int i = 0; i < indicator_windows_count; i++) {
+        xcb_destroy_window(conn, indicator_windows[i]);
+        if (indicator_pictures != NULL) {
+            xcb_render_free_picture(conn, indicator_pictures[i]);
+            xcb_free_pixmap(conn, indicator_pixmaps[i]);
+            for (int state = 0; state < PAM_STATES; state++)
+                xcb_render_free_picture(conn, indicator_bases[i * PAM_STATES + state]);
+        }
+    }
+    free(indicator_windows);
+    free(indicator_positions);
+    free(indicator_pixmaps);
+    free(indicator_pictures);
+    free(indicator_bases);
+    indicator_pixmaps = NULL;
+    indicator_pictures = NULL;
+    indicator_bases = NULL;
+    indicator_windows_mapped = false;
+
+    indicator_windows_count = (xr_screens > 0 ? xr_screens : 1);
+    indicator_windows = calloc(indicator_windows_count, sizeof(xcb_window_t));
+    indicator_positions = calloc(indicator_windows_count, sizeof(xcb_point_t));
+    if (indicator_windows == NULL || indicator_positions == NULL) {
+        /* No memory? Then there just is no unlock indicator. */
+        free(indicator_windows);
+        free(indicator_positions);
+        indicator_windows = NULL;
+        indicator_positions = NULL;
+        indicator_windows_count = 0;
+        return;
+    }
+
+    for (int i = 0; i < indicator_windows_count; i++) {
+        int x, y;
+        indicator_position(i, &x, &y);
+        indicator_positions[i].x = x;
+        indicator_positions[i].y = y;
+        indicator_windows[i] = open_indicator_window(conn, screen, win, x, y, BUTTON_DIAMETER);
+    }
+}
+
+#ifndef BACKEND_WAYLAND
+/* A lock-free triple buffer: the event loop thread writes
+ * frames[write_frame], the render thread draws frames[read_frame], and the
+ * third frame is in the mailbox. Both threads swap their frame with the one
+ * in the mailbox, so neither ever waits for the other. FRAME_NEW is set while
+ * the mailbox holds a frame which was not drawn yet, older frames which were
+ * not drawn in time are simply overwritten. */
+#define FRAME_NEW 4
+static frame_t frames[3];
+static int write_frame = 0;
+static int read_frame = 1;
+static int mailbox = 2;
+static sem_t frame_posted;
+static pthread_t render_thread;
+static bool render_thread_running = false;
+/* Wakes up the event loop after the render thread read from the X socket,
+ * see render(). */
+static struct ev_async events_queued;
+
+/* Held by the render thread while drawing a frame, and by the event loop
+ * thread while it changes what is drawn on (the background, the indicator
+ * windows). That only happens when the screen configuration changes. */
+static pthread_mutex_t render_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The layers of the unlock indicator. They are rendered once and kept on the
+ * X server, so that a frame only takes a few composite requests per indicator
+ * window instead of uploading pixels. The base layers are indexed by
+ * pam_state_t. The spinner and the highlights are drawn at angle 0 and rotated
+ * with a picture transformation.
+ *
+ * Each layer is translucent (around the circle, and the default colors of the
+ * inside have alpha), so they are ARGB32 pictures. Everything opaque is kept
+ * in the format of the root window: the background and the base layers
+ * composited onto it, which frames start from (see
+ * create_indicator_pictures()). The ARGB32 base layers are only read when
+ * those are created. */
+enum {
+    LAYER_BASE_IDLE = STATE_PAM_IDLE,
+    LAYER_BASE_VERIFY = STATE_PAM_VERIFY,
+    LAYER_BASE_WRONG = STATE_PAM_WRONG,
+    LAYER_SPINNER,
+    LAYER_KEY_HIGHLIGHT,
+    LAYER_BACKSPACE_HIGHLIGHT,
+    LAYERS
+};
+static xcb_render_picture_t layers[LAYERS];
+static bool layers_uploaded = false;
+/* Whether the X server supports everything we need from XRender. */
+static bool render_supported = false;
+static xcb_render_pictforminfo_t argb32_format;
+static xcb_render_pictformat_t root_format;
+
+#define DOUBLE_TO_FIXED(d) ((xcb_render_fixed_t)((d) * 65536))
+
+static void draw_layer(cairo_t *ctx, int layer) {
+    switch (layer) {
+        case LAYER_SPINNER:
+            draw_indicator_spinner(ctx);
+            break;
+        case LAYER_KEY_HIGHLIGHT:
+            draw_indicator_highlight(ctx, false);
+            break;
+        case LAYER_BACKSPACE_HIGHLIGHT:
+            draw_indicator_highlight(ctx, true);
+            break;
+        default:
+            draw_indicator_base(ctx, layer);
+            break;
+    }
+}
+
+/*
+ * Renders all layers of the unlock indicator and uploads them into ARGB32
+ * pictures on the X server. This happens only once, the theme cannot change
+ * while i3lock is running.
+ *
+ */
+static void upload_layers(void) {
+    layers_uploaded = true;
+
+    if (!get_render_formats(conn, screen, &argb32_format, &root_format)) {
+        fprintf(stderr, "The X server does not support XRender 0.6, not displaying the unlock indicator\n");
+        return;
+    }
+    render_supported = true;
+
+    for (int i = 0; i < LAYERS; i++) {
+        cairo_surface_t *output = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, BUTTON_DIAMETER, BUTTON_DIAMETER);
+        cairo_t *ctx = cairo_create(output);
+        draw_layer(ctx, i);
+        cairo_destroy(ctx);
+
+        xcb_pixmap_t pixmap = xcb_generate_id(conn);
+        xcb_create_pixmap(conn, 32, pixmap, screen->root, BUTTON_DIAMETER, BUTTON_DIAMETER);
+        cairo_surface_t *xcb_output = cairo_xcb_surface_create_with_xrender_format(
+            conn, screen, pixmap, &argb32_format, BUTTON_DIAMETER, BUTTON_DIAMETER);
+        cairo_t *xcb_ctx = cairo_create(xcb_output);
+        cairo_set_operator(xcb_ctx, CAIRO_OPERATOR_SOURCE);
+        cairo_set_source_surface(xcb_ctx, output, 0, 0);
+        cairo_paint(xcb_ctx);
+        cairo_destroy(xcb_ctx);
+        cairo_surface_finish(xcb_output);
+        cairo_surface_destroy(xcb_output);
+        cairo_surface_destroy(output);
+
+        /* The picture keeps the pixmap alive. */
+        layers[i] = xcb_generate_id(conn);
+        xcb_render_create_picture(conn, layers[i], pixmap, argb32_format.id, 0, NULL);
+        xcb_free_pixmap(conn, pixmap);
+
+        /* Rotated layers are sampled between pixels. */
+        if (i >= LAYER_SPINNER)
+            xcb_render_set_picture_filter(conn, layers[i], strlen("bilinear"), "bilinear", 0, NULL);
+    }
+}
+
+/*
+ * Sets the transformation of the given layer so that compositing it draws it
+ * rotated by angle around the center of the unlock indicator.
+ *
+ */
+static void rotate_layer(xcb_render_picture_t layer, double angle) {
+    /* The transformation maps destination to source coordinates, so it rotates
+     * by -angle. */
+    const double c = cos(angle), s = sin(angle), center = BUTTON_CENTER;
+    xcb_render_transform_t transform = {
+        DOUBLE_TO_FIXED(c), DOUBLE_TO_FIXED(s), DOUBLE_TO_FIXED(center - c * center - s * center),
+        DOUBLE_TO_FIXED(-s), DOUBLE_TO_FIXED(c), DOUBLE_TO_FIXED(center + s * center - c * center),
+        0, 0, DOUBLE_TO_FIXED(1)
+    };
+    xcb_render_set_picture_transform(conn, layer, transform);
+}
+
+/*
+ * Creates a pixmap in the format of the root window, with a picture for it.
+ * Returns the pixmap, the picture is stored in picture.
+ *
+ */
+static xcb_pixmap_t create_native_picture(xcb_render_picture_t *picture) {
+    xcb_pixmap_t pixmap = xcb_generate_id(conn);
+    xcb_create_pixmap(conn, screen->root_depth, pixmap, screen->root,
+                      BUTTON_DIAMETER, BUTTON_DIAMETER);
+    *picture = xcb_generate_id(conn);
+    xcb_render_create_picture(conn, *picture, pixmap, root_format, 0, NULL);
+    return pixmap;
+}
+
+/*
+ * Creates the pixmap (and picture) for each indicator window which the
+ * indicator is composited on, and composites the base layer of each PAM state
+ * onto the background underneath each window. A frame then starts with
+ * copying one of those (without converting pixels, the formats are the same)
+ * instead of blending the ARGB32 base layer onto the background. Returns
+ * false if there is no memory.
+ *
+ */
+static bool create_indicator_pictures(void) {
+    indicator_pixmaps = calloc(indicator_windows_count, sizeof(xcb_pixmap_t));
+    indicator_pictures = calloc(indicator_windows_count, sizeof(xcb_render_picture_t));
+    indicator_bases = calloc(indicator_windows_count * PAM_STATES, sizeof(xcb_render_picture_t));
+    if (indicator_pixmaps == NULL || indicator_pictures == NULL || indicator_bases == NULL) {
+        free(indicator_pixmaps);
+        free(indicator_pictures);
+        free(indicator_bases);
+        indicator_pixmaps = NULL;
+        indicator_pictures = NULL;
+        indicator_bases = NULL;
+        return false;
+    }
+
+    for (int i = 0; i < indicator_windows_count; i++) {
+        const xcb_point_t pos = indicator_positions[i];
+        indicator_pixmaps[i] = create_native_picture(&indicator_pictures[i]);
+
+        for (int state = 0; state < PAM_STATES; state++) {
+            xcb_render_picture_t base;
+            /* The picture keeps the pixmap alive. */
+            xcb_free_pixmap(conn, create_native_picture(&base));
+            xcb_render_composite(conn, XCB_RENDER_PICT_OP_SRC, bg_picture, XCB_NONE, base,
+                                 pos.x, pos.y, 0, 0, 0, 0, BUTTON_DIAMETER, BUTTON_DIAMETER);
+            xcb_render_composite(conn, XCB_RENDER_PICT_OP_OVER, layers[state], XCB_NONE, base,
+                                 0, 0, 0, 0, 0, 0, BUTTON_DIAMETER, BUTTON_DIAMETER);
+            indicator_bases[i * PAM_STATES + state] = base;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Composites the unlock indicator into every indicator window, on top of the
+ * part of the background underneath that window. This all happens on the X
+ * server, from the layers uploaded once by upload_layers(). The lock window
+ * itself is not touched. When the indicator is hidden, the indicator windows
+ * are unmapped. Called with render_lock held.
+ *
+ */
+static void redraw_indicator_windows(const frame_t *frame) {
+    const bool visible = (frame->unlock_state >= STATE_KEY_PRESSED && unlock_indicator);
+    if (!visible || (layers_uploaded && !render_supported)) {
+        if (indicator_windows_mapped) {
+            for (int i = 0; i < indicator_windows_count; i++)
+                xcb_unmap_window(conn, indicator_windows[i]);
+            indicator_windows_mapped = false;
+        }
+        histogram_add(&render_bytes, 0);
+        histogram_add(&render_surfaces, 0);
+        return;
+    }
+
+    if (!layers_uploaded) {
+        upload_layers();
+        if (!render_supported)
+            return;
+    }
+
+    if (bg_picture == XCB_NONE) {
+        /* A tile (-t) is repeated the same way the X server does for the lock
+         * window, i.e. starting at its origin. */
+        bg_picture = xcb_generate_id(conn);
+        xcb_render_create_picture(conn, bg_picture, bg_pixmap, root_format, XCB_RENDER_CP_REPEAT,
+                                  (uint32_t[1]){ bg_tiled ? XCB_RENDER_REPEAT_NORMAL : XCB_RENDER_REPEAT_NONE });
+    }
+
+    if (indicator_pictures == NULL && !create_indicator_pictures())
+        return;
+
+    xcb_render_picture_t overlays[2];
+    int num_overlays = 0;
+    if (frame->pam_state == STATE_PAM_VERIFY) {
+        rotate_layer(layers[LAYER_SPINNER], frame->spinner_angle);
+        overlays[num_overlays++] = layers[LAYER_SPINNER];
+    }
+    if (frame->unlock_state == STATE_KEY_ACTIVE ||
+        frame->unlock_state == STATE_BACKSPACE_ACTIVE) {
+        xcb_render_picture_t highlight = layers[frame->unlock_state == STATE_KEY_ACTIVE ? LAYER_KEY_HIGHLIGHT : LAYER_BACKSPACE_HIGHLIGHT];
+        rotate_layer(highlight, frame->highlight_angle);
+        overlays[num_overlays++] = highlight;
+    }
+
+    for (int i = 0; i < indicator_windows_count; i++) {
+        xcb_render_composite(conn, XCB_RENDER_PICT_OP_SRC, indicator_bases[i * PAM_STATES + frame->pam_state],
+                             XCB_NONE, indicator_pictures[i], 0, 0, 0, 0, 0, 0, BUTTON_DIAMETER, BUTTON_DIAMETER);
+        for (int j = 0; j < num_overlays; j++)
+            xcb_render_composite(conn, XCB_RENDER_PICT_OP_OVER, overlays[j], XCB_NONE, indicator_pictures[i],
+                                 0, 0, 0, 0, 0, 0, BUTTON_DIAMETER, BUTTON_DIAMETER);
+
+        /* Drawing into a background pixmap after setting it has an undefined
+         * effect on the window, so it is set again. */
+        xcb_change_window_attributes(conn, indicator_windows[i], XCB_CW_BACK_PIXMAP, (uint32_t[1]){ indicator_pixmaps[i] });
+        if (indicator_windows_mapped)
+            xcb_clear_area(conn, 0, indicator_windows[i], 0, 0, BUTTON_DIAMETER, BUTTON_DIAMETER);
+        else xcb_map_window(conn, indicator_windows[i]);
+    }
+    indicator_windows_mapped = true;
+
+    /* Copying the prepared base and compositing the overlays for every
+     * window, all of it on the X server. No surfaces are allocated. */
+    histogram_add(&render_bytes, (1 + num_overlays) * indicator_windows_count * BUTTON_DIAMETER * BUTTON_DIAMETER * 4);
+    histogram_add(&render_surfaces, 0);
+}
+
+/*
+ * Draws the latest frame from the mailbox, if it was not drawn yet.
+ *
+ */
+static void draw_latest_frame(void) {
+    if (!(__atomic_load_n(&mailbox, __ATOMIC_ACQUIRE) & FRAME_NEW))
+        return;
+    read_frame = __atomic_exchange_n(&mailbox, read_frame, __ATOMIC_ACQ_REL) & ~FRAME_NEW;
+
+    x_traffic_t before, after;
+    if (debug_mode)
+        x_traffic_get(conn, &before);
+
+    pthread_mutex_lock(&render_lock);
+    uint64_t start = now_ns();
+    redraw_indicator_windows(&frames[read_frame]);
+    x_flush(conn);
+    histogram_add(&render_time, now_ns() - start);
+    __atomic_add_fetch(&frames_drawn, 1, __ATOMIC_RELAXED);
+
+    /* In debug mode, wait until the X server has drawn the frame, which costs
+     * one round trip per frame (but does not delay the event loop). */
+    if (debug_mode) {
+        free(WAIT_REPLY(xcb_get_input_focus_reply(conn, xcb_get_input_focus(conn), NULL)));
+        histogram_add(&frame_latency, now_ns() - frames[read_frame].posted);
+
+        x_traffic_get(conn, &after);
+        histogram_add(&frame_requests, after.requests - before.requests);
+        histogram_add(&frame_bytes, after.bytes_sent - before.bytes_sent);
+        histogram_add(&frame_flushes, after.flushes - before.flushes);
+    }
+    pthread_mutex_unlock(&render_lock);
+}
+
+static void *render(void *arg) {
+    while (true) {
+        if (sem_wait(&frame_posted) == -1 && errno == EINTR)
+            continue;
+
+        const uint64_t read = xcb_total_read(conn);
+        draw_latest_frame();
+
+        /* Waiting for a reply (e.g. in upload_layers() or in debug mode) also
+         * reads the events which arrived in the meantime into xcb’s queue.
+         * The socket is not readable for them anymore, so the event loop has
+         * to be woken up to handle them (see xcb_check_cb() in i3lock.c). */
+        if (xcb_total_read(conn) != read)
+            ev_async_send(main_loop, &events_queued);
+    }
+    return NULL;
+}
+
+/*
+ * Does nothing: handling the queued events is up to the check watcher,
+ * which runs after every wakeup of the event loop.
+ *
+ */
+static void events_queued_cb(EV_P_ ev_async *w, int revents) {
+}
+
+/*
+ * Starts the render thread. Until then (and if that fails), frames are drawn
+ * right away by the event loop thread instead. Must only be called once
+ * i3lock does not fork anymore, the thread would not survive that.
+ *
+ */
+void start_render_thread(void) {
+    static bool tried = false;
+    if (tried)
+        return;
+    tried = true;
+
+    if (sem_init(&frame_posted, 0, 0) != 0)
+        return;
+    ev_async_init(&events_queued, events_queued_cb);
+    ev_async_start(main_loop, &events_queued);
+    if (pthread_create(&render_thread, NULL, render, NULL) != 0) {
+        ev_async_stop(main_loop, &events_queued);
+        sem_destroy(&frame_posted);
+        return;
+    }
+    render_thread_running = true;
+}
+#endif
+
+/*
+ * Re-renders the background onto a new pixmap and puts it into the lock
+ * window. Only necessary after the screen configuration changed.
+ *
+ */
+void redraw_background(void) {
+#ifndef BACKEND_WAYLAND
+    pthread_mutex_lock(&render_lock);
+    background_redraws++;
+    draw_image(last_resolution);
+    xcb_change_window_attributes(conn, win, XCB_CW_BACK_PIXMAP, (uint32_t[1]){ bg_pixmap });
+    xcb_clear_area(conn, 0, win, 0, 0, last_resolution[0], last_resolution[1]);
+    position_indicator_windows();
+    pthread_mutex_unlock(&render_lock);
+    redraw_screen();
+#endif
+}
+
+/*
+ * Redraws the unlock indicator. On X11, only the indicator windows are
+ * updated, the background of the lock window stays untouched. This happens
+ * asynchronously in the render thread, only the current state is recorded
+ * here.
  *
  */
 void redraw_screen(void) {
 #ifdef BACKEND_WAYLAND
-    window_schedule_redraw(window);
+    /* The background does not change, so only the areas of the unlock
+     * indicator (one per screen) need to be redrawn. */
+    const int screens = (xr_screens > 0 ? xr_screens : 1);
+    for (int screen = 0; screen < screens; screen++) {
+        int x, y;
+        indicator_position(screen, &x, &y);
+        window_add_damage(window, x, y, BUTTON_DIAMETER, BUTTON_DIAMETER);
+    }
+    window_schedule_redraw_damage(window);
 #else
-    xcb_pixmap_t bg_pixmap = draw_image(last_resolution);
-    xcb_change_window_attributes(conn, win, XCB_CW_BACK_PIXMAP, (uint32_t[1]){ bg_pixmap });
-    /* XXX: Possible optimization: Only update the area in the middle of the
-     * screen instead of the whole screen. */
-    xcb_clear_area(conn, 0, win, 0, 0, last_resolution[0], last_resolution[1]);
-    xcb_free_pixmap(conn, bg_pixmap);
-    xcb_flush(conn);
+    snapshot_frame(&frames[write_frame]);
+    write_frame = __atomic_exchange_n(&mailbox, write_frame | FRAME_NEW, __ATOMIC_ACQ_REL) & ~FRAME_NEW;
+
+    if (render_thread_running)
+        sem_post(&frame_posted);
+    else draw_latest_frame();
+#endif
+}
+
+/*
+ * Returns the number of frames drawn so far. Can be called from any thread.
+ *
+ */
+uint64_t drawn_frames(void) {
+    return __atomic_load_n(&frames_drawn, __ATOMIC_RELAXED);
+}
+
+/*
+ * Prints the statistics about all frames rendered so far.
+ *
+ */
+void print_render_stats(void) {
+#ifndef BACKEND_WAYLAND
+    pthread_mutex_lock(&render_lock);
+#endif
+    histogram_print(&render_time);
+    histogram_print(&render_bytes);
+    histogram_print(&render_surfaces);
+#ifndef BACKEND_WAYLAND
+    histogram_print(&frame_latency);
+    histogram_print(&frame_requests);
+    histogram_print(&frame_bytes);
+    histogram_print(&frame_flushes);
+    printf("[i3lock-debug] background redraws (full screen): %d, frames (indicator only): %llu\n",
+           background_redraws, (unsigned long long)drawn_frames());
+    pthread_mutex_unlock(&render_lock);
 #endif
 }
 
@@ -300,10 +1117,6 @@ static void clear_indicator(EV_P_ ev_timer *w, int revents) {
         unlock_state = STATE_STARTED;
     } else unlock_state = STATE_KEY_PRESSED;
     redraw_screen();
-
-    ev_timer_stop(main_loop, clear_indicator_timeout);
-    free(clear_indicator_timeout);
-    clear_indicator_timeout = NULL;
 }
 
 /*
@@ -312,18 +1125,9 @@ static void clear_indicator(EV_P_ ev_timer *w, int revents) {
  *
  */
 void start_clear_indicator_timeout(void) {
-    if (clear_indicator_timeout) {
-        ev_timer_stop(main_loop, clear_indicator_timeout);
-        ev_timer_set(clear_indicator_timeout, 1.0, 0.);
-        ev_timer_start(main_loop, clear_indicator_timeout);
-    } else {
-        /* When there is no memory, we just don’t have a timeout. We cannot
-         * exit() here, since that would effectively unlock the screen. */
-        if (!(clear_indicator_timeout = calloc(sizeof(struct ev_timer), 1)))
-            return;
-        ev_timer_init(clear_indicator_timeout, clear_indicator, 1.0, 0.);
-        ev_timer_start(main_loop, clear_indicator_timeout);
-    }
+    ev_timer_stop(main_loop, &clear_indicator_timeout);
+    ev_timer_init(&clear_indicator_timeout, clear_indicator, 1.0, 0.);
+    ev_timer_start(main_loop, &clear_indicator_timeout);
 }
 
 /*
@@ -331,9 +1135,33 @@ void start_clear_indicator_timeout(void) {
  *
  */
 void stop_clear_indicator_timeout(void) {
-    if (clear_indicator_timeout) {
-        ev_timer_stop(main_loop, clear_indicator_timeout);
-        free(clear_indicator_timeout);
-        clear_indicator_timeout = NULL;
-    }
+    ev_timer_stop(main_loop, &clear_indicator_timeout);
+}
+
+/*
+ * Advances the spinner by one frame. It completes one rotation per second.
+ *
+ */
+static void spinner_tick(EV_P_ ev_timer *w, int revents) {
+    spinner_angle = fmod(spinner_angle + (2 * M_PI / SPINNER_FPS), 2 * M_PI);
+    redraw_screen();
+}
+
+/*
+ * Starts animating the unlock indicator. Called when PAM starts verifying the
+ * password.
+ *
+ */
+void start_verify_spinner(void) {
+    spinner_angle = 0;
+    ev_timer_init(&spinner_timeout, spinner_tick, 1.0 / SPINNER_FPS, 1.0 / SPINNER_FPS);
+    ev_timer_start(main_loop, &spinner_timeout);
+}
+
+/*
+ * Stops animating the unlock indicator. Called as soon as PAM returns.
+ *
+ */
+void stop_verify_spinner(void) {
+    ev_timer_stop(main_loop, &spinner_timeout);
 }
@@ -1,6 +1,8 @@
 #ifndef _UNLOCK_INDICATOR_H
 #define _UNLOCK_INDICATOR_H
 
+#include <stdint.h>
+
 typedef enum {
     STATE_STARTED = 0,          /* default state */
     STATE_KEY_PRESSED = 1,      /* key was pressed, show unlock indicator */
@@ -16,10 +18,20 @@ typedef enum {
     STATE_PAM_WRONG = 2         /* the password was wrong */
 } pam_state_t;
 
+#define PAM_STATES 3
+
+void load_image(void);
 xcb_pixmap_t draw_image(uint32_t* resolution);
 void draw_image_core(cairo_t *screen_ctx, uint32_t *resolution);
+void position_indicator_windows(void);
+void redraw_background(void);
 void redraw_screen(void);
+void start_render_thread(void);
+uint64_t drawn_frames(void);
+void print_render_stats(void);
 void start_clear_indicator_timeout(void);
 void stop_clear_indicator_timeout(void);
+void start_verify_spinner(void);
+void stop_verify_spinner(void);
 
 #endif
@@ -68,6 +68,11 @@ struct buffer {
     void *shm_data;
     int shm_size;
     int busy;
+
+    /* The area which changed since this buffer was last drawn (NULL if
+     * nothing did). A region, so that the unlock indicators on several
+     * screens do not add up to everything between them. */
+    cairo_region_t *damage;
 };
 
 struct window {
@@ -170,6 +175,19 @@ static void buffer_reset(struct buffer *buffer) {
 
 static void window_redraw(struct window *window);
 
+/*
+ * Adds the given rectangle to the area of the buffer which needs to be redrawn
+ * the next time it is used.
+ *
+ */
+static void buffer_add_damage(struct buffer *buffer, int x, int y, int width, int height) {
+    const cairo_rectangle_int_t rect = { x, y, width, height };
+
+    if (!buffer->damage)
+        buffer->damage = cairo_region_create();
+    cairo_region_union_rectangle(buffer->damage, &rect);
+}
+
 static void frame_callback(void *data, struct wl_callback *callback, uint32_t time) {
     struct window *window = data;
 
@@ -208,29 +226,76 @@ static void window_redraw(struct window *window) {
             buffer_reset(buffer);
 
         buffer_init(buffer, window->display, window->width, window->height);
+
+        /* A new buffer has no content yet. */
+        cairo_region_destroy(buffer->damage);
+        buffer->damage = NULL;
+        buffer_add_damage(buffer, 0, 0, window->width, window->height);
     }
 
     if (window->current != buffer)
         wl_surface_attach(window->surface, buffer->buffer, 0, 0);
     window->current = buffer;
 
+    /* Only redraw what changed since this buffer was last drawn. The redraw
+     * handler always draws everything, but cairo skips what is clipped. */
+    cairo_region_t *damage = buffer->damage;
+    const int rects = (damage ? cairo_region_num_rectangles(damage) : 0);
+    buffer->damage = NULL;
+
     cairo_t *cairo = cairo_create(buffer->cairo_surface);
+    for (int i = 0; i < rects; i++) {
+        cairo_rectangle_int_t rect;
+        cairo_region_get_rectangle(damage, i, &rect);
+        cairo_rectangle(cairo, rect.x, rect.y, rect.width, rect.height);
+    }
+    cairo_clip(cairo);
     window->redraw_handler(window, cairo);
     cairo_destroy(cairo);
 
     window->current->busy = 1;
     wl_callback_add_listener(wl_surface_frame(window->surface), &listener, window);
-    wl_surface_damage(window->surface, 0, 0, window->width, window->height);
+    for (int i = 0; i < rects; i++) {
+        cairo_rectangle_int_t rect;
+        cairo_region_get_rectangle(damage, i, &rect);
+        wl_surface_damage(window->surface, rect.x, rect.y, rect.width, rect.height);
+    }
     wl_surface_commit(window->surface);
+    cairo_region_destroy(damage);
 }
 
-void window_schedule_redraw(struct window *window) {
+/*
+ * Marks the given area of the window as changed, without redrawing it yet
+ * (see window_schedule_redraw_damage()). Both buffers remember the area, since
+ * each of them has to be brought up to date when it is used next.
+ *
+ */
+void window_add_damage(struct window *window, int x, int y, int width, int height) {
+    buffer_add_damage(&window->buffers[0], x, y, width, height);
+    buffer_add_damage(&window->buffers[1], x, y, width, height);
+}
+
+/*
+ * Schedules redrawing the areas added with window_add_damage(), right away or
+ * once the compositor is done with the last frame.
+ *
+ */
+void window_schedule_redraw_damage(struct window *window) {
     if (!window->redrawing)
         window_redraw(window);
     else
         window->redraw_scheduled = true;
 }
 
+void window_schedule_redraw_area(struct window *window, int x, int y, int width, int height) {
+    window_add_damage(window, x, y, width, height);
+    window_schedule_redraw_damage(window);
+}
+
+void window_schedule_redraw(struct window *window) {
+    window_schedule_redraw_area(window, 0, 0, window->width, window->height);
+}
+
 static void await_frame_callback(void *data, struct wl_callback *callback, uint32_t time) {
     bool *still_waiting = data;
     *still_waiting = false;
@@ -296,6 +361,8 @@ void destroy_window(struct window *window) {
         wl_buffer_destroy(window->buffers[0].buffer);
     if (window->buffers[1].buffer)
         wl_buffer_destroy(window->buffers[1].buffer);
+    cairo_region_destroy(window->buffers[0].damage);
+    cairo_region_destroy(window->buffers[1].damage);
 
     wl_shell_surface_destroy(window->shell_surface);
     wl_surface_destroy(window->surface);
@@ -48,6 +48,9 @@ void display_run(struct display *display);
 struct window *create_window(struct display *display, int width, int height);
 void destroy_window(struct window *window);
 void window_schedule_redraw(struct window *window);
+void window_schedule_redraw_area(struct window *window, int x, int y, int width, int height);
+void window_add_damage(struct window *window, int x, int y, int width, int height);
+void window_schedule_redraw_damage(struct window *window);
 void window_await_frame(struct window *window);
 
 #endif
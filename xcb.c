@@ -10,18 +10,113 @@
 #include <xcb/xcb.h>
 #include <xcb/xcb_image.h>
 #include <xcb/dpms.h>
+#include <xcb/shm.h>
+#include <xcb/render.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
 #include <assert.h>
 #include <err.h>
+#include <cairo.h>
 
 #include "cursors.h"
+#include "xcb.h"
 
 xcb_connection_t *conn;
 xcb_screen_t *screen;
 
+/* The round trips and flushes counted so far, see x_traffic_get(). Updated
+ * atomically, since the render thread uses the connection as well. */
+static uint64_t round_trips = 0;
+static uint64_t flushes = 0;
+/* The NoOperation requests sent by x_traffic_get() itself. */
+static uint64_t probes = 0;
+/* The totals at the end of the last phase, see x_traffic_phase(). */
+static x_traffic_t last_phase;
+
+/*
+ * Counts one round trip, i.e. one reply we wait for. Use WAIT_REPLY().
+ *
+ */
+void x_traffic_count_round_trip(void) {
+    __atomic_add_fetch(&round_trips, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Flushes the connection, counting the flushes which actually wrote
+ * something.
+ *
+ */
+void x_flush(xcb_connection_t *conn) {
+    uint64_t written = xcb_total_written(conn);
+    xcb_flush(conn);
+    if (xcb_total_written(conn) != written)
+        __atomic_add_fetch(&flushes, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Gets the traffic on the connection so far. XCB does not tell us how many
+ * requests were sent, so this sends a NoOperation request and takes its
+ * sequence number (the probes themselves are not counted). Meant for debug
+ * mode only.
+ *
+ */
+void x_traffic_get(xcb_connection_t *conn, x_traffic_t *traffic) {
+    unsigned int sequence = xcb_no_operation(conn).sequence;
+    uint64_t probe = __atomic_add_fetch(&probes, 1, __ATOMIC_RELAXED);
+    xcb_flush(conn);
+
+    /* A NoOperation request is 4 bytes long. */
+    traffic->requests = sequence - probe;
+    traffic->bytes_sent = xcb_total_written(conn) - 4 * probe;
+    traffic->bytes_received = xcb_total_read(conn);
+    traffic->round_trips = __atomic_load_n(&round_trips, __ATOMIC_RELAXED);
+    traffic->flushes = __atomic_load_n(&flushes, __ATOMIC_RELAXED);
+}
+
+static void print_traffic(const char *what, const x_traffic_t *t) {
+    printf("[i3lock-debug] X traffic %s: %llu requests, %llu bytes sent, %llu bytes received, "
+           "%llu round trips, %llu flushes\n",
+           what,
+           (unsigned long long)t->requests, (unsigned long long)t->bytes_sent,
+           (unsigned long long)t->bytes_received, (unsigned long long)t->round_trips,
+           (unsigned long long)t->flushes);
+}
+
+/*
+ * Prints the traffic since the end of the last phase (or since connecting),
+ * e.g. for "startup: background". Meant for debug mode only.
+ *
+ */
+void x_traffic_phase(xcb_connection_t *conn, const char *phase) {
+    x_traffic_t now, delta;
+    x_traffic_get(conn, &now);
+    delta.requests = now.requests - last_phase.requests;
+    delta.bytes_sent = now.bytes_sent - last_phase.bytes_sent;
+    delta.bytes_received = now.bytes_received - last_phase.bytes_received;
+    delta.round_trips = now.round_trips - last_phase.round_trips;
+    delta.flushes = now.flushes - last_phase.flushes;
+    last_phase = now;
+
+    char what[64];
+    snprintf(what, sizeof(what), "for %s", phase);
+    print_traffic(what, &delta);
+}
+
+/*
+ * Prints the traffic since connecting. Meant for debug mode only.
+ *
+ */
+void x_traffic_print(xcb_connection_t *conn) {
+    x_traffic_t now;
+    x_traffic_get(conn, &now);
+    print_traffic("in total", &now);
+}
+
 #define curs_invisible_width 8
 #define curs_invisible_height 8
 
@@ -46,17 +141,6 @@ static unsigned char mask_windows_bits[] = {
  0xf7, 0x00, 0xf3, 0x00, 0xe1, 0x01, 0xe0, 0x01, 0xc0, 0x03, 0xc0, 0x03,
  0x80, 0x01 };
 
-static uint32_t get_colorpixel(char *hex) {
-    char strgroups[3][3] = {{hex[0], hex[1], '\0'},
-                            {hex[2], hex[3], '\0'},
-                            {hex[4], hex[5], '\0'}};
-    uint32_t rgb16[3] = {(strtol(strgroups[0], NULL, 16)),
-                         (strtol(strgroups[1], NULL, 16)),
-                         (strtol(strgroups[2], NULL, 16))};
-
-    return (rgb16[0] << 16) + (rgb16[1] << 8) + rgb16[2];
-}
-
 xcb_visualtype_t *get_root_visual_type(xcb_screen_t *screen) {
     xcb_visualtype_t *visual_type = NULL;
     xcb_depth_iterator_t depth_iter;
@@ -80,7 +164,40 @@ xcb_visualtype_t *get_root_visual_type(xcb_screen_t *screen) {
     return NULL;
 }
 
-xcb_pixmap_t create_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, u_int32_t* resolution, char *color) {
+/*
+ * Scales the 8 bit component into the bits of the given mask of a visual.
+ *
+ */
+static uint32_t scale_component(uint32_t component, uint32_t mask) {
+    if (mask == 0)
+        return 0;
+    int shift = 0;
+    while (!(mask & (1u << shift)))
+        shift++;
+    const uint32_t max = mask >> shift;
+    return ((component * max + 127) / 255) << shift;
+}
+
+/*
+ * Returns the pixel value of the given color (rrggbb) on the root visual,
+ * e.g. 0xf81f for magenta at depth 16. On a visual which is not TrueColor
+ * (there are no masks to build it from), this is either the white or the
+ * black pixel of the screen, whichever is closer.
+ *
+ */
+uint32_t get_pixel(xcb_screen_t *scr, uint32_t rgb) {
+    const uint32_t red = (rgb >> 16) & 0xff, green = (rgb >> 8) & 0xff, blue = rgb & 0xff;
+    xcb_visualtype_t *visual = get_root_visual_type(scr);
+
+    if (visual == NULL || visual->_class != XCB_VISUAL_CLASS_TRUE_COLOR)
+        return (red + green + blue >= 3 * 128 ? scr->white_pixel : scr->black_pixel);
+
+    return scale_component(red, visual->red_mask) |
+           scale_component(green, visual->green_mask) |
+           scale_component(blue, visual->blue_mask);
+}
+
+xcb_pixmap_t create_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, u_int32_t* resolution, uint32_t color) {
     xcb_pixmap_t bg_pixmap = xcb_generate_id(conn);
     xcb_create_pixmap(conn, scr->root_depth, bg_pixmap, scr->root,
                       resolution[0], resolution[1]);
@@ -88,7 +205,7 @@ xcb_pixmap_t create_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, u_int32
     /* Generate a Graphics Context and fill the pixmap with background color
      * (for images that are smaller than your screen) */
     xcb_gcontext_t gc = xcb_generate_id(conn);
-    uint32_t values[] = { get_colorpixel(color) };
+    uint32_t values[] = { color };
     xcb_create_gc(conn, gc, bg_pixmap, XCB_GC_FOREGROUND, values);
     xcb_rectangle_t rect = { 0, 0, resolution[0], resolution[1] };
     xcb_poly_fill_rectangle(conn, bg_pixmap, gc, 1, &rect);
@@ -97,14 +214,14 @@ xcb_pixmap_t create_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, u_int32
     return bg_pixmap;
 }
 
-xcb_window_t open_fullscreen_window(xcb_connection_t *conn, xcb_screen_t *scr, char *color, xcb_pixmap_t pixmap) {
+xcb_window_t open_fullscreen_window(xcb_connection_t *conn, xcb_screen_t *scr, uint32_t color, xcb_pixmap_t pixmap) {
     uint32_t mask = 0;
     uint32_t values[3];
     xcb_window_t win = xcb_generate_id(conn);
 
     if (pixmap == XCB_NONE) {
         mask |= XCB_CW_BACK_PIXEL;
-        values[0] = get_colorpixel(color);
+        values[0] = color;
     } else {
         mask |= XCB_CW_BACK_PIXMAP;
         values[0] = pixmap;
@@ -133,27 +250,117 @@ xcb_window_t open_fullscreen_window(xcb_connection_t *conn, xcb_screen_t *scr, c
                       mask,
                       values);
 
-    /* Map the window (= make it visible) */
+    return win;
+}
+
+/*
+ * Maps the lock window (= makes it visible) and puts it on top.
+ *
+ */
+void map_fullscreen_window(xcb_connection_t *conn, xcb_window_t win) {
     xcb_map_window(conn, win);
 
-    /* Raise window (put it on top) */
-    values[0] = XCB_STACK_MODE_ABOVE;
+    uint32_t values[] = { XCB_STACK_MODE_ABOVE };
     xcb_configure_window(conn, win, XCB_CONFIG_WINDOW_STACK_MODE, values);
+}
+
+/*
+ * Opens a small child window of the lock window, used to display the unlock
+ * indicator on top of the background. It is not mapped yet, the caller maps
+ * it once there is content to display.
+ *
+ */
+xcb_window_t open_indicator_window(xcb_connection_t *conn, xcb_screen_t *scr, xcb_window_t parent, int16_t x, int16_t y, uint16_t size) {
+    xcb_window_t win = xcb_generate_id(conn);
+
+    xcb_create_window(conn,
+                      XCB_COPY_FROM_PARENT,
+                      win, /* the window id */
+                      parent,
+                      x, y,
+                      size, size, /* dimensions */
+                      0, /* border = 0, we draw our own */
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT,
+                      XCB_WINDOW_CLASS_COPY_FROM_PARENT, /* copy visual from parent */
+                      0,
+                      NULL);
 
     return win;
 }
 
+/*
+ * Looks up the XRender picture formats for ARGB32 and for the root visual.
+ * Returns false if the X server does not support XRender 0.6 (which added
+ * transformations and filters) or one of the formats is missing.
+ *
+ */
+bool get_render_formats(xcb_connection_t *conn, xcb_screen_t *scr, xcb_render_pictforminfo_t *argb32, xcb_render_pictformat_t *root) {
+    const xcb_query_extension_reply_t *extension = xcb_get_extension_data(conn, &xcb_render_id);
+    if (extension == NULL || !extension->present)
+        return false;
+
+    xcb_render_query_version_cookie_t version_cookie = xcb_render_query_version(conn, 0, 11);
+    xcb_render_query_pict_formats_cookie_t formats_cookie = xcb_render_query_pict_formats(conn);
+    xcb_render_query_version_reply_t *version = WAIT_REPLY(xcb_render_query_version_reply(conn, version_cookie, NULL));
+    xcb_render_query_pict_formats_reply_t *formats = WAIT_REPLY(xcb_render_query_pict_formats_reply(conn, formats_cookie, NULL));
+    bool found_argb32 = false, found_root = false;
+
+    if (version == NULL || formats == NULL ||
+        (version->major_version == 0 && version->minor_version < 6))
+        goto out;
+
+    xcb_render_pictforminfo_t *info = xcb_render_query_pict_formats_formats(formats);
+    for (int i = 0; i < xcb_render_query_pict_formats_formats_length(formats); i++) {
+        if (info[i].type == XCB_RENDER_PICT_TYPE_DIRECT && info[i].depth == 32 &&
+            info[i].direct.alpha_mask == 0xff && info[i].direct.alpha_shift == 24 &&
+            info[i].direct.red_mask == 0xff && info[i].direct.red_shift == 16 &&
+            info[i].direct.green_mask == 0xff && info[i].direct.green_shift == 8 &&
+            info[i].direct.blue_mask == 0xff && info[i].direct.blue_shift == 0) {
+            *argb32 = info[i];
+            found_argb32 = true;
+            break;
+        }
+    }
+
+    for (xcb_render_pictscreen_iterator_t screens = xcb_render_query_pict_formats_screens_iterator(formats);
+         screens.rem && !found_root;
+         xcb_render_pictscreen_next(&screens)) {
+        for (xcb_render_pictdepth_iterator_t depths = xcb_render_pictscreen_depths_iterator(screens.data);
+             depths.rem && !found_root;
+             xcb_render_pictdepth_next(&depths)) {
+            for (xcb_render_pictvisual_iterator_t visuals = xcb_render_pictdepth_visuals_iterator(depths.data);
+                 visuals.rem;
+                 xcb_render_pictvisual_next(&visuals)) {
+                if (visuals.data->visual == scr->root_visual) {
+                    *root = visuals.data->format;
+                    found_root = true;
+                    break;
+                }
+            }
+        }
+    }
+
+out:
+    free(version);
+    free(formats);
+    return (found_argb32 && found_root);
+}
+
+/*
+ * Turns off the screen. DPMS has to be enabled (see xcb_dpms_enable()).
+ *
+ */
 void dpms_turn_off_screen(xcb_connection_t *conn) {
-    xcb_dpms_enable(conn);
     xcb_dpms_force_level(conn, XCB_DPMS_DPMS_MODE_OFF);
-    xcb_flush(conn);
+    x_flush(conn);
 }
 
 /*
- * Repeatedly tries to grab pointer and keyboard (up to 1000 times).
+ * Repeatedly tries to grab pointer and keyboard (up to 10000 times). Returns
+ * false (with neither of them grabbed) if that did not succeed.
  *
  */
-void grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb_cursor_t cursor) {
+bool grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb_cursor_t cursor) {
     xcb_grab_pointer_cookie_t pcookie;
     xcb_grab_pointer_reply_t *preply;
 
@@ -161,6 +368,7 @@ void grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb
     xcb_grab_keyboard_reply_t *kreply;
 
     int tries = 10000;
+    bool pointer = false, keyboard = false;
 
     while (tries-- > 0) {
         pcookie = xcb_grab_pointer(
@@ -175,17 +383,19 @@ void grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb
             XCB_CURRENT_TIME
         );
 
-        if ((preply = xcb_grab_pointer_reply(conn, pcookie, NULL)) &&
+        if ((preply = WAIT_REPLY(xcb_grab_pointer_reply(conn, pcookie, NULL))) &&
             preply->status == XCB_GRAB_STATUS_SUCCESS) {
             free(preply);
+            pointer = true;
             break;
         }
+        free(preply);
 
         /* Make this quite a bit slower */
         usleep(50);
     }
 
-    while (tries-- > 0) {
+    while (pointer && tries-- > 0) {
         kcookie = xcb_grab_keyboard(
             conn,
             true,                /* report events */
@@ -195,18 +405,27 @@ void grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb
             XCB_GRAB_MODE_ASYNC
         );
 
-        if ((kreply = xcb_grab_keyboard_reply(conn, kcookie, NULL)) &&
+        if ((kreply = WAIT_REPLY(xcb_grab_keyboard_reply(conn, kcookie, NULL))) &&
             kreply->status == XCB_GRAB_STATUS_SUCCESS) {
             free(kreply);
+            keyboard = true;
             break;
         }
+        free(kreply);
 
         /* Make this quite a bit slower */
         usleep(50);
     }
 
-    if (tries <= 0)
-        errx(EXIT_FAILURE, "Cannot grab pointer/keyboard");
+    if (pointer && !keyboard)
+        xcb_ungrab_pointer(conn, XCB_CURRENT_TIME);
+
+    return keyboard;
+}
+
+void ungrab_pointer_and_keyboard(xcb_connection_t *conn) {
+    xcb_ungrab_pointer(conn, XCB_CURRENT_TIME);
+    xcb_ungrab_keyboard(conn, XCB_CURRENT_TIME);
 }
 
 xcb_cursor_t create_cursor(xcb_connection_t *conn, xcb_screen_t *screen, xcb_window_t win, int choice) {
@@ -271,3 +490,163 @@ xcb_cursor_t create_cursor(xcb_connection_t *conn, xcb_screen_t *screen, xcb_win
 
     return cursor;
 }
+
+/*
+ * Returns the cairo image format whose pixels are stored just like the ones of
+ * the root window (the same depth, bits per pixel, color masks and byte
+ * order), or CAIRO_FORMAT_INVALID if there is none. Images in that format can
+ * be transferred to and from the X server without converting them.
+ *
+ */
+cairo_format_t get_native_format(xcb_connection_t *conn, xcb_screen_t *scr) {
+    const xcb_setup_t *setup = xcb_get_setup(conn);
+    const uint16_t one = 1;
+    const bool little_endian = (*(const uint8_t *)&one == 1);
+
+    if (setup->image_byte_order != (little_endian ? XCB_IMAGE_ORDER_LSB_FIRST : XCB_IMAGE_ORDER_MSB_FIRST))
+        return CAIRO_FORMAT_INVALID;
+
+    xcb_visualtype_t *visual = get_root_visual_type(scr);
+    if (visual == NULL || visual->_class != XCB_VISUAL_CLASS_TRUE_COLOR)
+        return CAIRO_FORMAT_INVALID;
+
+    int bits_per_pixel = 0;
+    for (xcb_format_iterator_t iter = xcb_setup_pixmap_formats_iterator(setup);
+         iter.rem;
+         xcb_format_next(&iter)) {
+        if (iter.data->depth == scr->root_depth && iter.data->scanline_pad == 32)
+            bits_per_pixel = iter.data->bits_per_pixel;
+    }
+
+    static const struct {
+        cairo_format_t format;
+        uint8_t depth;
+        int bits_per_pixel;
+        uint32_t red_mask, green_mask, blue_mask;
+    } formats[] = {
+        { CAIRO_FORMAT_RGB16_565, 16, 16, 0xf800, 0x07e0, 0x001f },
+        { CAIRO_FORMAT_RGB24, 24, 32, 0xff0000, 0x00ff00, 0x0000ff },
+        { CAIRO_FORMAT_RGB30, 30, 32, 0x3ff00000, 0x000ffc00, 0x000003ff },
+    };
+
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (formats[i].depth == scr->root_depth &&
+            formats[i].bits_per_pixel == bits_per_pixel &&
+            formats[i].red_mask == visual->red_mask &&
+            formats[i].green_mask == visual->green_mask &&
+            formats[i].blue_mask == visual->blue_mask)
+            return formats[i].format;
+    }
+
+    return CAIRO_FORMAT_INVALID;
+}
+
+static void copy_rows(uint8_t *dest, int dest_stride, const uint8_t *src, uint16_t width, uint16_t height) {
+    for (int y = 0; y < height; y++)
+        memcpy(dest + y * dest_stride, src + y * width * 4, width * 4);
+}
+
+/*
+ * Gets the contents of the root window via a shared memory segment, which
+ * saves the X server from sending the whole image over the socket.
+ *
+ */
+static bool get_root_image_shm(xcb_connection_t *conn, xcb_screen_t *scr, uint16_t width, uint16_t height,
+                               uint8_t *dest, int dest_stride) {
+    if (!xcb_get_extension_data(conn, &xcb_shm_id)->present)
+        return false;
+
+    int shmid = shmget(IPC_PRIVATE, (size_t)width * height * 4, IPC_CREAT | 0600);
+    if (shmid == -1)
+        return false;
+
+    uint8_t *data = shmat(shmid, NULL, 0);
+    if (data == (void *)-1) {
+        shmctl(shmid, IPC_RMID, NULL);
+        return false;
+    }
+
+    xcb_shm_seg_t segment = xcb_generate_id(conn);
+    xcb_shm_attach(conn, segment, shmid, false);
+    xcb_shm_get_image_cookie_t cookie = xcb_shm_get_image(conn, scr->root, 0, 0, width, height,
+                                                          ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, segment, 0);
+    xcb_shm_get_image_reply_t *reply = WAIT_REPLY(xcb_shm_get_image_reply(conn, cookie, NULL));
+    xcb_shm_detach(conn, segment);
+
+    /* The X server attached the segment by now, so it can be marked for
+     * removal. It is destroyed once the last process detached. */
+    shmctl(shmid, IPC_RMID, NULL);
+
+    if (reply != NULL)
+        copy_rows(dest, dest_stride, data, width, height);
+
+    shmdt(data);
+    free(reply);
+    return (reply != NULL);
+}
+
+/*
+ * Gets the contents of the root window via a plain GetImage request.
+ *
+ */
+static bool get_root_image(xcb_connection_t *conn, xcb_screen_t *scr, uint16_t width, uint16_t height,
+                           uint8_t *dest, int dest_stride) {
+    xcb_get_image_cookie_t cookie = xcb_get_image(conn, XCB_IMAGE_FORMAT_Z_PIXMAP, scr->root,
+                                                  0, 0, width, height, ~0);
+    xcb_get_image_reply_t *reply = WAIT_REPLY(xcb_get_image_reply(conn, cookie, NULL));
+    if (reply == NULL)
+        return false;
+
+    bool ok = (xcb_get_image_data_length(reply) >= width * height * 4);
+    if (ok)
+        copy_rows(dest, dest_stride, xcb_get_image_data(reply), width, height);
+
+    free(reply);
+    return ok;
+}
+
+/*
+ * Captures the contents of the root window (i.e. of all screens) into a new
+ * Cairo image surface. Must be called before opening the lock window. Returns
+ * NULL if the screen contents cannot be captured.
+ *
+ * The size of the root window is queried every time: in daemon mode, the
+ * screen configuration might have changed since connecting.
+ *
+ */
+cairo_surface_t *capture_root_window(xcb_connection_t *conn, xcb_screen_t *scr) {
+    if (get_native_format(conn, scr) != CAIRO_FORMAT_RGB24) {
+        fprintf(stderr, "Cannot capture the screen, unsupported root window format (depth %d)\n",
+                scr->root_depth);
+        return NULL;
+    }
+
+    xcb_get_geometry_reply_t *geom = WAIT_REPLY(xcb_get_geometry_reply(conn, xcb_get_geometry(conn, scr->root), NULL));
+    if (geom == NULL) {
+        fprintf(stderr, "Cannot capture the screen, could not get the size of the root window\n");
+        return NULL;
+    }
+    const uint16_t width = geom->width;
+    const uint16_t height = geom->height;
+    free(geom);
+
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(surface);
+        return NULL;
+    }
+
+    cairo_surface_flush(surface);
+    uint8_t *dest = cairo_image_surface_get_data(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+
+    if (!get_root_image_shm(conn, scr, width, height, dest, stride) &&
+        !get_root_image(conn, scr, width, height, dest, stride)) {
+        fprintf(stderr, "Cannot capture the screen\n");
+        cairo_surface_destroy(surface);
+        return NULL;
+    }
+
+    cairo_surface_mark_dirty(surface);
+    return surface;
+}
@@ -1,16 +1,46 @@
 #ifndef _XCB_H
 #define _XCB_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <xcb/xcb.h>
+#include <xcb/render.h>
+#include <cairo.h>
 
 extern xcb_connection_t *conn;
 extern xcb_screen_t *screen;
 
+/* The traffic on the X connection, printed in debug mode. */
+typedef struct x_traffic {
+    uint64_t requests;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t round_trips;
+    uint64_t flushes;
+} x_traffic_t;
+
+/* Waits for a reply (the given xcb_*_reply() call) and counts the round
+ * trip. */
+#define WAIT_REPLY(call) (x_traffic_count_round_trip(), (call))
+
+void x_traffic_count_round_trip(void);
+void x_flush(xcb_connection_t *conn);
+void x_traffic_get(xcb_connection_t *conn, x_traffic_t *traffic);
+void x_traffic_phase(xcb_connection_t *conn, const char *phase);
+void x_traffic_print(xcb_connection_t *conn);
+
 xcb_visualtype_t *get_root_visual_type(xcb_screen_t *s);
-xcb_pixmap_t create_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, u_int32_t *resolution, char *color);
-xcb_window_t open_fullscreen_window(xcb_connection_t *conn, xcb_screen_t *scr, char *color, xcb_pixmap_t pixmap);
-void grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb_cursor_t cursor);
+uint32_t get_pixel(xcb_screen_t *scr, uint32_t rgb);
+xcb_pixmap_t create_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, u_int32_t *resolution, uint32_t color);
+xcb_window_t open_fullscreen_window(xcb_connection_t *conn, xcb_screen_t *scr, uint32_t color, xcb_pixmap_t pixmap);
+void map_fullscreen_window(xcb_connection_t *conn, xcb_window_t win);
+xcb_window_t open_indicator_window(xcb_connection_t *conn, xcb_screen_t *scr, xcb_window_t parent, int16_t x, int16_t y, uint16_t size);
+bool get_render_formats(xcb_connection_t *conn, xcb_screen_t *scr, xcb_render_pictforminfo_t *argb32, xcb_render_pictformat_t *root);
+bool grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb_cursor_t cursor);
+void ungrab_pointer_and_keyboard(xcb_connection_t *conn);
 void dpms_turn_off_screen(xcb_connection_t *conn);
 xcb_cursor_t create_cursor(xcb_connection_t *conn, xcb_screen_t *screen, xcb_window_t win, int choice);
+cairo_format_t get_native_format(xcb_connection_t *conn, xcb_screen_t *scr);
+cairo_surface_t *capture_root_window(xcb_connection_t *conn, xcb_screen_t *scr);
 
 #endif
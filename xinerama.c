@@ -36,7 +36,7 @@ void xinerama_init(void) {
     xcb_xinerama_is_active_reply_t *reply;
 
     cookie = xcb_xinerama_is_active(conn);
-    reply = xcb_xinerama_is_active_reply(conn, cookie, NULL);
+    reply = WAIT_REPLY(xcb_xinerama_is_active_reply(conn, cookie, NULL));
     if (!reply)
         return;
 
@@ -58,7 +58,7 @@ void xinerama_query_screens(void) {
     xcb_xinerama_screen_info_t *screen_info;
 
     cookie = xcb_xinerama_query_screens_unchecked(conn);
-    reply = xcb_xinerama_query_screens_reply(conn, cookie, NULL);
+    reply = WAIT_REPLY(xcb_xinerama_query_screens_reply(conn, cookie, NULL));
     if (!reply) {
         if (debug_mode)
             fprintf(stderr, "Couldn't get Xinerama screens\n");